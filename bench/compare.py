@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+
+"""compare benchmark results (google benchmark json) against a baseline.
+
+usage: compare.py BASELINE CURRENT [--threshold T] [--metric M]
+
+BASELINE and CURRENT are directories of <program>.json files (or single
+files). benchmarks are matched by program and name; medians are used when
+the results hold aggregates. exits with status 1 if any benchmark is slower
+than the baseline by more than the threshold (a fraction, default 0.10)."""
+
+import argparse
+import json
+import os
+import sys
+
+UNITS = {'ns': 1e-9, 'us': 1e-6, 'ms': 1e-3, 's': 1.}
+
+
+def load(path):
+    with open(path) as f:
+        entries = json.load(f)['benchmarks']
+
+    medians = [e for e in entries if e.get('aggregate_name') == 'median']
+    results = {}
+    for e in medians or entries:
+        if e.get('run_type') == 'aggregate' and not medians:
+            continue
+
+        name = e.get('run_name', e['name'])
+        results[name] = e
+
+    return results
+
+
+def collect(path):
+    if os.path.isfile(path):
+        return {os.path.basename(path): load(path)}
+
+    return {name: load(os.path.join(path, name))
+            for name in sorted(os.listdir(path)) if name.endswith('.json')}
+
+
+def seconds(entry, metric):
+    return entry[metric] * UNITS[entry.get('time_unit', 'ns')]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('baseline')
+    parser.add_argument('current')
+    parser.add_argument('--threshold', type=float, default=0.10)
+    parser.add_argument('--metric', default='real_time',
+                        choices=['real_time', 'cpu_time'])
+    args = parser.parse_args()
+
+    baseline = collect(args.baseline)
+    current = collect(args.current)
+
+    slower = []
+    for program, results in sorted(current.items()):
+        reference = baseline.get(program)
+        if reference is None:
+            print('%s: no baseline' % program)
+            continue
+
+        for name, entry in results.items():
+            if name not in reference:
+                print('%-60s %10s' % (name, 'new'))
+                continue
+
+            before = seconds(reference[name], args.metric)
+            after = seconds(entry, args.metric)
+            change = after / before - 1. if before > 0 else 0.
+
+            flag = ''
+            if change > args.threshold:
+                flag = ' SLOWER'
+                slower.append(name)
+
+            print('%-60s %+9.1f%%%s' % (name, 100. * change, flag))
+
+    if slower:
+        print('%d benchmark(s) slower than baseline by more than %.0f%%'
+              % (len(slower), 100. * args.threshold))
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
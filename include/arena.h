@@ -0,0 +1,44 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+/* monotonic allocator: memory is carved out of large aligned blocks and
+ * released all at once when the arena is destroyed. objects made in the
+ * arena are not destroyed by it; their owner runs the destructors */
+class arena {
+  public:
+    static constexpr std::size_t alignment = 64;
+
+    explicit arena(std::size_t block = 1 << 20);
+
+    arena(arena const&) = delete;
+    arena& operator=(arena const&) = delete;
+    ~arena();
+
+    /* thread-safe; align must be a power of two no larger than alignment */
+    void* allocate(std::size_t size,
+                   std::size_t align = alignof(std::max_align_t));
+
+    template <typename T, typename... U>
+    T* make(U&&... args) {
+        return new (allocate(sizeof(T), alignof(T)))
+            T(std::forward<U>(args)...); }
+
+    std::size_t used() const { return _used; }
+
+  private:
+    std::size_t _block;
+
+    std::mutex _mutex;
+    std::vector<char*> _blocks;
+    char* _head;
+    std::size_t _left;
+    std::size_t _used;
+};
+
+#endif /* ARENA_H */
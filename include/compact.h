@@ -0,0 +1,132 @@
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include "interval.h"
+
+#include "TH1.h"
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+class TDirectory;
+
+/* bin storage of a compact cell, in order of promotion */
+enum class precision { u8, u16, u32, f64 };
+
+/* one-dimensional histogram with adaptive bin storage, usable as the cell
+ * type of a history. bins start as 8-bit counters and are widened, all at
+ * once, when a count would overflow (to 16, then 32 bits, then double) or
+ * on the first fill, addition or scaling that is not a unit count (to
+ * double). sums of squared weights are only kept from then on; before,
+ * they equal the contents. provides the subset of the TH1 interface used by
+ * history, and converts to a TH1D when written */
+class compact {
+  public:
+    compact(interval const* axis, std::string const& name,
+            std::string const& title);
+
+    compact(compact const&) = delete;
+    compact& operator=(compact const&) = delete;
+    ~compact() = default;
+
+    int Fill(double value) {
+        int64_t bin = _axis->index_for(value) + 1;
+        increment(bin);
+        _entries = _entries + 1;
+
+        return bin;
+    }
+
+    int Fill(double value, double weight);
+
+    void FillN(int64_t count, double const* values, double const* weights,
+               int64_t stride = 1);
+
+    bool Add(compact const* other, double c1 = 1);
+    void Scale(double c1, char const* = "");
+    void Reset(char const* = "");
+
+    compact* Clone(char const* name = "") const;
+
+    TH1D* root(char const* name) const;
+    int Write(char const* name = nullptr, int option = 0,
+              int size = 0) const;
+
+    double GetBinContent(int64_t bin) const;
+    double GetBinError(int64_t bin) const;
+    void SetBinContent(int64_t bin, double content);
+    void SetBinError(int64_t bin, double error);
+
+    double Integral() const;
+
+    double GetEntries() const { return _entries; }
+    void SetEntries(double entries) { _entries = entries; }
+
+    int64_t GetNbinsX() const { return _bins - 2; }
+    int64_t GetNcells() const { return _bins; }
+
+    char const* GetName() const { return _name.data(); }
+    char const* GetTitle() const { return _title.data(); }
+    void SetName(char const* name) { _name = name; }
+    void SetTitle(char const* title) { _title = title; }
+    void SetDirectory(TDirectory*) { }
+
+    interval const* axis() const { return _axis; }
+
+    precision width() const { return _width; }
+    bool weighted() const { return !_sumw2.empty(); }
+
+    /* bytes held by the bin storage */
+    std::size_t bytes() const;
+
+  private:
+    void increment(int64_t bin) {
+        switch (_width) {
+            case precision::u8:
+                if (_u8[bin] < std::numeric_limits<uint8_t>::max()) {
+                    ++_u8[bin]; return; }
+                break;
+            case precision::u16:
+                if (_u16[bin] < std::numeric_limits<uint16_t>::max()) {
+                    ++_u16[bin]; return; }
+                break;
+            case precision::u32:
+                if (_u32[bin] < std::numeric_limits<uint32_t>::max()) {
+                    ++_u32[bin]; return; }
+                break;
+            case precision::f64:
+                _f64[bin] += 1;
+                if (weighted()) { _sumw2[bin] += 1; }
+                return;
+        }
+
+        promote(static_cast<precision>(static_cast<int>(_width) + 1));
+        increment(bin);
+    }
+
+    void promote(precision width);
+    void weigh();
+
+    interval const* _axis;
+    int64_t _bins;
+
+    /* only the storage of the current width is allocated */
+    precision _width;
+    std::vector<uint8_t> _u8;
+    std::vector<uint16_t> _u16;
+    std::vector<uint32_t> _u32;
+    std::vector<double> _f64;
+    std::vector<double> _sumw2;
+
+    double _entries;
+
+    std::string _name;
+    std::string _title;
+};
+
+/* compact cells never attach to a directory */
+inline compact* detach(compact* obj) { return obj; }
+
+#endif /* COMPACT_H */
@@ -0,0 +1,281 @@
+#ifndef CUMULATIVE_H
+#define CUMULATIVE_H
+
+#include "history.h"
+#include "multival.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/* integrals: one value per cell, its Integral(). bins: one value per bin of
+ * each cell (global bin numbers, flow bins included), for queries over
+ * ranges of bins as well as of cells */
+enum class summed { integrals, bins };
+
+/* summed-area table over the cells of a history, answering integrals over
+ * hyper-rectangles of cells in 2^rank lookups (2^(rank + 1) with bins).
+ * missing cells count as empty. the table is a snapshot: after cells
+ * change, update them (or rebuild) before querying again. queries may run
+ * concurrently with each other, but not with update */
+template <typename H>
+class cumulative {
+  public:
+    explicit cumulative(history<H> const& source,
+                        summed mode = summed::integrals)
+            : cumulative(source, nullptr, mode) {
+    }
+
+    /* intervals (as for a memory over source) map values to cells */
+    cumulative(history<H> const& source, multival const* intervals,
+               summed mode = summed::integrals)
+            : _source(&source),
+              _intervals(intervals),
+              _mode(mode),
+              _bins(1) {
+        if (_mode == summed::bins) {
+            int64_t i = 0;
+            while (i < source.size() && !source[i]) { ++i; }
+            if (i == source.size()) {
+                throw std::invalid_argument(
+                    "cumulative: no cell in " + source.tag() + " for bins"); }
+
+            _bins = source[i]->GetNcells();
+            _shape.push_back(_bins);
+        }
+
+        _shape.insert(std::end(_shape), std::begin(source.shape()),
+                      std::end(source.shape()));
+        _dims = _shape.size();
+
+        int64_t block = 1;
+        int64_t padded = 1;
+        for (auto const& extent : _shape) {
+            _strides.push_back(block);
+            _padded.push_back(padded);
+            block = block * extent;
+            padded = padded * (extent + 1);
+        }
+
+        _values.assign(block, 0.);
+        _table.assign(padded, 0.);
+
+        rebuild();
+    }
+
+    cumulative(cumulative const&) = delete;
+    cumulative& operator=(cumulative const&) = delete;
+    ~cumulative() = default;
+
+    /* sum over cells in [first, last) along each axis */
+    template <template <typename...> class T, typename U>
+    typename std::enable_if<std::is_integral<U>::value, double>::type
+    integral(T<U> const& first, T<U> const& last) const {
+        return integral(first, last, 0, _bins); }
+
+    /* sum over bins [lower, upper) of cells in [first, last) */
+    template <template <typename...> class T, typename U>
+    typename std::enable_if<std::is_integral<U>::value, double>::type
+    integral(T<U> const& first, T<U> const& last, int64_t lower,
+             int64_t upper) const {
+        std::vector<int64_t> low;
+        std::vector<int64_t> high;
+        if (_mode == summed::bins) {
+            low.push_back(lower);
+            high.push_back(upper);
+        }
+
+        low.insert(std::end(low), std::begin(first), std::end(first));
+        high.insert(std::end(high), std::begin(last), std::end(last));
+
+        return corners(low, high);
+    }
+
+    /* sum over cells containing values in [lower, upper] along each axis,
+     * as TH1::Integral between the bins of lower and upper. values out of
+     * range select the first or last cell (the flow cells with flow::cells) */
+    template <template <typename...> class T, typename U>
+    typename std::enable_if<std::is_floating_point<U>::value, double>::type
+    integral(T<U> const& lower, T<U> const& upper) const {
+        if (!_intervals) {
+            throw std::logic_error("cumulative: no intervals for values"); }
+
+        std::vector<int64_t> first;
+        std::vector<int64_t> last;
+        auto x = std::begin(lower);
+        auto y = std::begin(upper);
+        for (int64_t i = 0; i < _intervals->dims(); ++i, ++x, ++y) {
+            first.push_back(locate(i, *x));
+            last.push_back(locate(i, *y) + 1);
+        }
+
+        return integral(first, last);
+    }
+
+    /* re-read the given cells, then recompute only the part of the table
+     * they affect: entries at or above the lowest changed index on every
+     * axis */
+    void update(std::vector<int64_t> const& indices) {
+        if (indices.empty()) { return; }
+
+        std::vector<int64_t> box(_dims, 1);
+        for (int64_t i = _mode == summed::bins; i < _dims; ++i) {
+            box[i] = _shape[i];
+            for (auto index : indices) {
+                auto at = index * _bins / _strides[i] % _shape[i];
+                box[i] = std::min(box[i], at + 1);
+            }
+        }
+
+        for (auto index : indices) { load(index); }
+
+        sweep(box);
+    }
+
+    void update(int64_t index) { update(std::vector<int64_t>({ index })); }
+
+    void rebuild() {
+        for (int64_t i = 0; i < _source->size(); ++i) { load(i); }
+
+        sweep(std::vector<int64_t>(_dims, 1));
+    }
+
+    summed mode() const { return _mode; }
+    int64_t bins() const { return _bins; }
+
+  private:
+    /* value(s) of one cell, into _values */
+    void load(int64_t index) {
+        auto obj = (*_source)[index];
+        auto data = _values.data() + index * _bins;
+
+        if (_mode == summed::integrals) {
+            *data = obj ? obj->Integral() : 0.; return; }
+
+        if (obj && obj->GetNcells() != _bins) {
+            throw std::invalid_argument(
+                "cumulative: cell " + std::to_string(index) + " has "
+                + std::to_string(obj->GetNcells()) + " bins, expected "
+                + std::to_string(_bins));
+        }
+
+        for (int64_t j = 0; j < _bins; ++j)
+            data[j] = obj ? obj->GetBinContent(j) : 0.;
+    }
+
+    /* recompute table entries in the box from coordinates (padded, so at
+     * least 1) to the end of every axis, in flat order: each entry is its
+     * value plus the inclusion-exclusion sum of its lower neighbours, all of
+     * which are either outside the box or already recomputed */
+    void sweep(std::vector<int64_t> const& from) {
+        std::vector<int64_t> offsets;
+        std::vector<double> signs;
+        for (int64_t mask = 1; mask < (int64_t(1) << _dims); ++mask) {
+            int64_t offset = 0;
+            double sign = -1.;
+            for (int64_t i = 0; i < _dims; ++i) {
+                if (mask & (int64_t(1) << i)) {
+                    offset = offset + _padded[i];
+                    sign = -sign;
+                }
+            }
+
+            offsets.push_back(offset);
+            signs.push_back(sign);
+        }
+
+        std::vector<int64_t> counter = from;
+        int64_t p = 0;
+        int64_t u = 0;
+        for (int64_t i = 0; i < _dims; ++i) {
+            p = p + counter[i] * _padded[i];
+            u = u + (counter[i] - 1) * _strides[i];
+        }
+
+        while (true) {
+            double sum = _values[u];
+            for (std::size_t k = 0; k < offsets.size(); ++k)
+                sum = sum + signs[k] * _table[p - offsets[k]];
+
+            _table[p] = sum;
+
+            int64_t i = 0;
+            for (; i < _dims; ++i) {
+                if (++counter[i] <= _shape[i]) {
+                    p = p + _padded[i];
+                    u = u + _strides[i];
+                    break;
+                }
+
+                p = p - (_shape[i] - from[i]) * _padded[i];
+                u = u - (_shape[i] - from[i]) * _strides[i];
+                counter[i] = from[i];
+            }
+
+            if (i == _dims) { break; }
+        }
+    }
+
+    /* inclusion-exclusion over the corners of [low, high) */
+    double corners(std::vector<int64_t> const& low,
+                   std::vector<int64_t> const& high) const {
+        if (static_cast<int64_t>(low.size()) != _dims
+                || static_cast<int64_t>(high.size()) != _dims) {
+            throw std::invalid_argument("cumulative: rank mismatch"); }
+
+        for (int64_t i = 0; i < _dims; ++i) {
+            if (low[i] < 0 || high[i] > _shape[i]) {
+                throw std::out_of_range("cumulative: range out of shape"); }
+            if (low[i] >= high[i]) { return 0.; }
+        }
+
+        double result = 0.;
+        for (int64_t mask = 0; mask < (int64_t(1) << _dims); ++mask) {
+            int64_t p = 0;
+            double sign = 1.;
+            for (int64_t i = 0; i < _dims; ++i) {
+                if (mask & (int64_t(1) << i)) {
+                    p = p + low[i] * _padded[i];
+                    sign = -sign;
+                } else {
+                    p = p + high[i] * _padded[i];
+                }
+            }
+
+            result = result + sign * _table[p];
+        }
+
+        return result;
+    }
+
+    /* cell along axis i containing value, clamped to the axis */
+    int64_t locate(int64_t i, double value) const {
+        auto const& axis = _intervals->axis(i);
+        int64_t index = axis.index_for(value);
+
+        if (_intervals->mode() == flow::cells) { return index + 1; }
+        return std::min(std::max<int64_t>(index, 0), axis.size() - 1);
+    }
+
+    history<H> const* _source;
+    multival const* _intervals;
+
+    summed _mode;
+    int64_t _bins;
+
+    /* table axes: bins first (bins mode only), then the source axes */
+    int64_t _dims;
+    std::vector<int64_t> _shape;
+    std::vector<int64_t> _strides;
+    std::vector<int64_t> _padded;
+
+    /* values per cell (or bin), and the table, padded with a leading zero
+     * entry on every axis so that no lookup needs a bounds check */
+    std::vector<double> _values;
+    std::vector<double> _table;
+};
+
+#endif /* CUMULATIVE_H */
@@ -0,0 +1,256 @@
+#ifndef DENSE_H
+#define DENSE_H
+
+#include "arena.h"
+#include "interval.h"
+
+#include "TH1.h"
+#include "TObject.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+template <typename T>
+class dense;
+
+/* one-dimensional histogram whose bins live in a dense store (or in its own
+ * buffer, once cloned). provides the subset of the TH1 interface used by
+ * history, and converts to a TH1F/TH1D only when written. saved files hold
+ * plain ROOT histograms: read them back as history<TH1F> (or TH1D) */
+template <typename T>
+class cell {
+  public:
+    using root_type = typename std::conditional<
+        std::is_same<T, float>::value, TH1F, TH1D>::type;
+
+    cell(interval const* axis, T* contents, T* sumw2,
+         std::string const& name, std::string const& title)
+        : _axis(axis),
+          _bins(axis->size() + 2),
+          _contents(contents),
+          _sumw2(sumw2),
+          _entries(0),
+          _pooled(false),
+          _name(name),
+          _title(title) {
+    }
+
+    cell(cell const&) = delete;
+    cell& operator=(cell const&) = delete;
+    ~cell() = default;
+
+    int Fill(double value) { return Fill(value, 1.); }
+
+    int Fill(double value, double weight) {
+        int64_t bin = _axis->index_for(value) + 1;
+        _contents[bin] += weight;
+        _sumw2[bin] += weight * weight;
+        _entries = _entries + 1;
+
+        return bin;
+    }
+
+    void FillN(int64_t count, double const* values, double const* weights,
+               int64_t stride = 1) {
+        for (int64_t i = 0; i < count * stride; i = i + stride)
+            Fill(values[i], weights ? weights[i] : 1.);
+    }
+
+    bool Add(cell const* other, double c1 = 1) {
+        if (other->_bins != _bins) { return false; }
+
+        for (int64_t i = 0; i < _bins; ++i) {
+            _contents[i] += c1 * other->_contents[i];
+            _sumw2[i] += c1 * c1 * other->_sumw2[i];
+        }
+
+        _entries = _entries + other->_entries;
+        return true;
+    }
+
+    void Scale(double c1, char const* = "") {
+        for (int64_t i = 0; i < _bins; ++i) {
+            _contents[i] *= c1;
+            _sumw2[i] *= c1 * c1;
+        }
+    }
+
+    void Reset(char const* = "") {
+        std::fill(_contents, _contents + _bins, 0);
+        std::fill(_sumw2, _sumw2 + _bins, 0);
+        _entries = 0;
+    }
+
+    /* clones own their bins; they do not live in the dense store */
+    cell* Clone(char const* name = "") const {
+        auto result = new cell(_axis, nullptr, nullptr,
+                               *name ? name : _name, _title);
+        result->_owned.assign(_contents, _contents + _bins);
+        result->_owned.insert(std::end(result->_owned), _sumw2,
+                              _sumw2 + _bins);
+        result->_contents = result->_owned.data();
+        result->_sumw2 = result->_owned.data() + _bins;
+        result->_entries = _entries;
+
+        return result;
+    }
+
+    root_type* root(char const* name) const {
+        auto result = new root_type(name, _title.data(), _axis->size(),
+                                    _axis->edges());
+        result->SetDirectory(nullptr);
+        result->Sumw2();
+        for (int64_t i = 0; i < _bins; ++i) {
+            result->SetBinContent(i, _contents[i]);
+            result->SetBinError(i, std::sqrt(_sumw2[i]));
+        }
+
+        result->SetEntries(_entries);
+        return result;
+    }
+
+    int Write(char const* name = nullptr, int option = 0,
+              int size = 0) const {
+        auto out = root(name && *name ? name : _name.data());
+        auto bytes = out->Write(nullptr, option, size);
+        delete out;
+
+        return bytes;
+    }
+
+    double GetBinContent(int64_t bin) const { return _contents[bin]; }
+    double GetBinError(int64_t bin) const { return std::sqrt(_sumw2[bin]); }
+    void SetBinContent(int64_t bin, double content) {
+        _contents[bin] = content; }
+    void SetBinError(int64_t bin, double error) {
+        _sumw2[bin] = error * error; }
+
+    double Integral() const {
+        return std::accumulate(_contents + 1, _contents + _bins - 1, 0.); }
+
+    double GetEntries() const { return _entries; }
+    void SetEntries(double entries) { _entries = entries; }
+
+    int64_t GetNbinsX() const { return _bins - 2; }
+    int64_t GetNcells() const { return _bins; }
+
+    char const* GetName() const { return _name.data(); }
+    char const* GetTitle() const { return _title.data(); }
+    void SetName(char const* name) { _name = name; }
+    void SetTitle(char const* title) { _title = title; }
+
+    interval const* axis() const { return _axis; }
+
+    /* booked in the arena of a dense store */
+    bool pooled() const { return _pooled; }
+
+  private:
+    friend class dense<T>;
+
+    interval const* _axis;
+    int64_t _bins;
+
+    T* _contents;
+    T* _sumw2;
+    std::vector<T> _owned;
+
+    double _entries;
+    bool _pooled;
+
+    std::string _name;
+    std::string _title;
+};
+
+/* cells booked from a dense store live in its arena, which frees them at
+ * once: history only runs their destructors */
+template <typename T>
+void dispose(cell<T>* obj) {
+    if (obj->pooled()) { obj->~cell(); } else { delete obj; } }
+
+/* cells never attach to a directory */
+template <typename T>
+cell<T>* detach(cell<T>* obj) { return obj; }
+
+/* bin contents of every cell in one contiguous, aligned buffer laid out as
+ * [cell][bin] (under- and overflow included), with sumw2 in a parallel
+ * buffer. rows are padded to a multiple of the alignment. the buffers and
+ * the cells booked from the store are allocated in one arena, released
+ * with the store; histories of its cells must not outlive it */
+template <typename T>
+class dense {
+  public:
+    static constexpr int64_t alignment = arena::alignment;
+
+    dense(interval const* axis, int64_t cells)
+        : _axis(axis),
+          _cells(cells),
+          _bins(axis->size() + 2),
+          _stride(padded(_bins)),
+          _contents(allocate(cells * _stride)),
+          _sumw2(allocate(cells * _stride)) {
+    }
+
+    dense(dense const&) = delete;
+    dense& operator=(dense const&) = delete;
+    ~dense() = default;
+
+    cell<T>* book(int64_t index, std::string const& name,
+                  std::string const& ordinate) const {
+        auto title = ";" + _axis->abscissa() + ";" + ordinate;
+        auto result = _arena.make<cell<T>>(_axis, row(_contents, index),
+                                           row(_sumw2, index), name, title);
+        result->_pooled = true;
+
+        return result;
+    }
+
+    /* factory for history<cell<T>> */
+    std::function<cell<T>*(int64_t, std::string const&,
+                           std::string const&)> factory() const {
+        return [this](int64_t index, std::string const& name,
+                      std::string const& ordinate) {
+            return book(index, name, ordinate); };
+    }
+
+    T* contents(int64_t index) const { return row(_contents, index); }
+    T* sumw2(int64_t index) const { return row(_sumw2, index); }
+
+    int64_t cells() const { return _cells; }
+    int64_t bins() const { return _bins; }
+    int64_t stride() const { return _stride; }
+
+  private:
+    static int64_t padded(int64_t bins) {
+        int64_t block = alignment / sizeof(T);
+        return (bins + block - 1) / block * block;
+    }
+
+    T* allocate(int64_t count) {
+        auto data = static_cast<T*>(
+            _arena.allocate(count * sizeof(T), alignment));
+        std::fill(data, data + count, 0);
+
+        return data;
+    }
+
+    T* row(T* data, int64_t index) const {
+        return data + index * _stride; }
+
+    mutable arena _arena;
+
+    interval const* _axis;
+
+    int64_t _cells;
+    int64_t _bins;
+    int64_t _stride;
+
+    T* _contents;
+    T* _sumw2;
+};
+
+#endif /* DENSE_H */
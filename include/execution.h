@@ -0,0 +1,67 @@
+#ifndef EXECUTION_H
+#define EXECUTION_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class policy { serial, pool, steal };
+
+/* runs f(i) for i in [0, count). serial: in order on the calling thread.
+ * pool: each worker (the caller included) takes one contiguous block.
+ * steal: workers take small chunks from a shared counter until exhausted.
+ * tasks must be independent; histograms are booked with TH1::AddDirectory
+ * disabled while a parallel run is in progress. if a task throws, no more
+ * items are started, and the first exception is rethrown on the calling
+ * thread once every worker has finished */
+class execution {
+  public:
+    explicit execution(policy mode = policy::serial, int64_t threads = 0);
+
+    execution(execution const&) = delete;
+    execution& operator=(execution const&) = delete;
+    ~execution();
+
+    template <typename T>
+    void run(int64_t count, T const& f) {
+        if (_workers.empty() || count < 2) {
+            for (int64_t i = 0; i < count; ++i) { f(i); }
+            return;
+        }
+
+        dispatch(count, std::function<void(int64_t)>(f));
+    }
+
+    policy mode() const { return _mode; }
+    int64_t threads() const { return _workers.size() + 1; }
+
+  private:
+    void dispatch(int64_t count, std::function<void(int64_t)> const& task);
+    void execute(int64_t slot);
+    void work(int64_t slot);
+
+    policy _mode;
+    std::vector<std::thread> _workers;
+
+    std::mutex _dispatch;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+
+    std::function<void(int64_t)> const* _task;
+    int64_t _count;
+    int64_t _grain;
+    int64_t _pending;
+    uint64_t _generation;
+    bool _stop;
+
+    std::atomic<int64_t> _next;
+    std::atomic<bool> _failed;
+    std::exception_ptr _error;
+};
+
+#endif /* EXECUTION_H */
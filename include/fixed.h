@@ -0,0 +1,224 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+#include "execution.h"
+#include "history.h"
+
+#include "TFile.h"
+
+#include <array>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* history of rank N known at compile time. shape and strides are held in
+ * std::array, so index arithmetic is a fixed number of multiply-adds and
+ * the axis loops below have constant trip counts that the compiler unrolls.
+ * a fixed<H, N> is a history<H>, and a history<H> of rank N can be adopted
+ * by moving it into a fixed<H, N> */
+template <typename H, std::size_t N>
+class fixed : public history<H> {
+  public:
+    static_assert(N > 0, "fixed: rank must be positive");
+
+    using indices_type = std::array<int64_t, N>;
+
+    fixed(std::string const& tag, std::string const& label,
+          std::function<H*(int64_t,
+                           std::string const&,
+                           std::string const&)> factory,
+          indices_type const& shape, booking mode = booking::eager)
+        : history<H>(tag, label, factory,
+                     std::vector<int64_t>(std::begin(shape), std::end(shape)),
+                     mode) {
+        init();
+    }
+
+    fixed(std::string const& tag, std::string const& label,
+          indices_type const& shape)
+        : history<H>(tag, label,
+                     std::vector<int64_t>(std::begin(shape), std::end(shape))) {
+        init();
+    }
+
+    fixed(TFile* f, std::string const& tag)
+        : history<H>(f, tag) {
+        init();
+    }
+
+    /* throws std::invalid_argument if the rank of other is not N */
+    explicit fixed(history<H>&& other)
+        : history<H>(std::move(other)) {
+        init();
+    }
+
+    fixed(fixed const&) = delete;
+    fixed& operator=(fixed const&) = delete;
+    fixed(fixed&&) = default;
+    fixed& operator=(fixed&&) = default;
+    ~fixed() = default;
+
+    using history<H>::index_for;
+
+    int64_t index_for(indices_type const& indices) const {
+        int64_t index = 0;
+        for (std::size_t i = 0; i < N; ++i)
+            index = index + indices[i] * _strides[i];
+
+        return index;
+    }
+
+    using history<H>::indices_for;
+
+    indices_type indices_for(int64_t index) const {
+        indices_type indices;
+        for (std::size_t i = 0; i < N; ++i) {
+            indices[i] = index % _extents[i];
+            index = index / _extents[i];
+        }
+
+        return indices;
+    }
+
+    using history<H>::operator[];
+
+    H*& operator[](indices_type const& indices) {
+        return this->touch(index_for(indices)); }
+
+    H* const& operator[](indices_type const& indices) const {
+        return this->objects[index_for(indices)]; }
+
+    using history<H>::sum;
+
+    /* as history::sum(axis), with rank N - 1 (or 1, for N = 1). throws
+     * std::invalid_argument unless 0 <= axis < N */
+    fixed<H, (N > 1 ? N - 1 : 1)>* sum(int64_t axis) const {
+        execution serial; return sum(serial, axis); }
+
+    fixed<H, (N > 1 ? N - 1 : 1)>* sum(execution& exec, int64_t axis) const {
+        check(axis, N);
+
+        std::array<int64_t, (N > 1 ? N - 1 : 1)> shape;
+        std::array<int64_t, (N > 1 ? N - 1 : 1)> strides;
+        shape[0] = 1;
+        strides[0] = 0;
+        for (std::size_t i = 0, k = 0; i < N; ++i) {
+            if (static_cast<int64_t>(i) == axis) { continue; }
+
+            shape[k] = _extents[i];
+            strides[k] = _strides[i];
+            ++k;
+        }
+
+        auto result = new fixed<H, (N > 1 ? N - 1 : 1)>(
+            this->_tag + "_sum" + std::to_string(axis), this->_label, shape);
+
+        auto extent = _extents[axis];
+        auto stride = _strides[axis];
+        exec.run(result->size(), [&](int64_t i) {
+            auto indices = result->indices_for(i);
+
+            int64_t base = 0;
+            for (std::size_t k = 0; k < shape.size(); ++k)
+                base = base + indices[k] * strides[k];
+
+            H* sum = nullptr;
+            for (int64_t j = 0; j < extent; ++j) {
+                auto obj = this->objects[base + j * stride];
+                if (!obj) { continue; }
+
+                if (!sum) {
+                    sum = detach(static_cast<H*>(obj->Clone()));
+                    sum->Reset("MICES");
+                }
+
+                sum->Add(obj);
+            }
+
+            (*result)[i] = sum;
+        });
+
+        return result;
+    }
+
+    /* as history::extend, with rank N + 1. throws std::invalid_argument
+     * unless 0 <= axis <= N */
+    fixed<H, N + 1>* extend(std::string const& prefix, int64_t axis,
+                            int64_t size) const {
+        check(axis, N + 1);
+
+        std::array<int64_t, N + 1> shape;
+        for (std::size_t i = 0, k = 0; i < N + 1; ++i) {
+            shape[i] = static_cast<int64_t>(i) == axis ? size
+                : _extents[k++]; }
+
+        auto result = new fixed<H, N + 1>(prefix + "_" + this->_tag,
+                                          this->_label, shape);
+
+        std::array<int64_t, N> strides;
+        for (std::size_t i = 0; i < N; ++i) {
+            strides[i] = static_cast<int64_t>(i) < axis ? _strides[i]
+                : _strides[i] * size; }
+
+        auto stride = axis < static_cast<int64_t>(N)
+            ? _strides[axis] : this->_size;
+        for (int64_t i = 0; i < this->_size; ++i) {
+            auto indices = indices_for(i);
+
+            int64_t base = 0;
+            for (std::size_t k = 0; k < N; ++k)
+                base = base + indices[k] * strides[k];
+
+            auto obj = this->objects[i];
+            for (int64_t j = 0; j < size; ++j)
+                (*result)[base + j * stride] = obj
+                    ? detach((H*)obj->Clone()) : nullptr;
+        }
+
+        return result;
+    }
+
+    /* as history::shrink, cloning only the cells kept */
+    fixed* shrink(std::string const& tag, indices_type const& shape,
+                  indices_type const& offset) const {
+        auto result = new fixed(tag + "_" + this->_tag, this->_label, shape);
+
+        int64_t base = index_for(offset);
+        for (int64_t i = 0; i < result->size(); ++i) {
+            auto obj = this->objects[base + index_for(result->indices_for(i))];
+            (*result)[i] = obj ? detach((H*)obj->Clone()) : nullptr;
+        }
+
+        return result;
+    }
+
+    indices_type const& extents() const { return _extents; }
+    indices_type const& strides() const { return _strides; }
+
+  private:
+    void init() {
+        if (this->_dims != static_cast<int64_t>(N)) {
+            throw std::invalid_argument("fixed: rank of " + this->_tag
+                                        + " is not " + std::to_string(N)); }
+
+        int64_t block = 1;
+        for (std::size_t i = 0; i < N; ++i) {
+            _extents[i] = this->_shape[i];
+            _strides[i] = block;
+            block = block * _extents[i];
+        }
+    }
+
+    void check(int64_t axis, std::size_t bound) const {
+        if (axis < 0 || axis >= static_cast<int64_t>(bound)) {
+            throw std::invalid_argument("fixed: axis " + std::to_string(axis)
+                                        + " out of range for " + this->_tag); }
+    }
+
+    indices_type _extents;
+    indices_type _strides;
+};
+
+#endif /* FIXED_H */
@@ -1,14 +1,25 @@
 #ifndef HISTORY_H
 #define HISTORY_H
 
+#include "execution.h"
+#include "instrument.h"
+
 #include "TFile.h"
+#include "TH1.h"
+#include "TList.h"
 #include "TNamed.h"
 #include "TObject.h"
+#include "TTree.h"
 
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <functional>
 #include <iterator>
+#include <map>
+#include <memory>
 #include <numeric>
+#include <stdexcept>
 #include <string>
 #include <type_traits>
 #include <utility>
@@ -17,6 +28,147 @@
 using x = std::initializer_list<int64_t> const;
 using v = std::initializer_list<double> const;
 
+/* eager: book every cell at construction. lazy: book a cell on first
+ * non-const access; cells never touched stay null and count as empty */
+enum class booking { eager, lazy };
+
+/* sum: (optionally weighted) sum over cells. mean: sum divided by the
+ * number of cells reduced, missing cells included */
+enum class reduction { sum, mean };
+
+/* objects: one key per cell and a TNamed shape descriptor. packed: a single
+ * TTree, titled with the shape, with one entry (flat index, bin contents,
+ * errors, entries) per cell and an empty prototype cell as user info. the
+ * packed layout requires all cells to share the binning of the prototype */
+enum class layout { objects, packed };
+
+/* half-open range [first, last) of flat cell indices; last < 0 for all */
+struct selection { int64_t first; int64_t last; };
+
+/* release a cell owned by a history. cell types not allocated with plain
+ * new provide an overload */
+template <typename H>
+void dispose(H* obj) { delete obj; }
+
+/* take a cell just booked, cloned or read for a history out of the
+ * current directory, so that it is owned by the history alone. each object
+ * is detached on its own: the process-wide TH1::AddDirectory flag is left
+ * alone, as cells are booked from several threads at once. cell types that
+ * never attach to a directory provide an overload */
+template <typename H>
+H* detach(H* obj) {
+    if (obj) { obj->SetDirectory(nullptr); }
+    return obj;
+}
+
+/* write count cells in the packed layout (see layout) as a tree named
+ * name in the current directory. next(k, index, contents, errors, entries)
+ * supplies the k-th cell, in ascending flat index. the tree takes the
+ * prototype (if any) as its user info */
+template <typename F>
+void pack(std::string const& name, std::string const& title,
+          TObject* prototype, Int_t bins, int64_t count, F next) {
+    auto tree = new TTree(name.data(), title.data());
+    if (prototype) { tree->GetUserInfo()->Add(prototype); }
+
+    Long64_t index = 0;
+    double entries = 0;
+    std::vector<double> contents(bins);
+    std::vector<double> errors(bins);
+
+    tree->Branch("index", &index, "index/L");
+    tree->Branch("bins", &bins, "bins/I");
+    tree->Branch("contents", contents.data(), "contents[bins]/D");
+    tree->Branch("errors", errors.data(), "errors[bins]/D");
+    tree->Branch("entries", &entries, "entries/D");
+
+    for (int64_t k = 0; k < count; ++k) {
+        next(k, index, contents.data(), errors.data(), entries);
+        tree->Fill();
+    }
+
+    tree->Write("", TObject::kOverwrite);
+    delete tree;
+}
+
+/* cells are numbered by flat index, the first axis running fastest, and
+ * named by their tag followed by "_i" for each of their indices. a saved
+ * shape is the same suffix of its extents, e.g. "_3_4" */
+
+/* append "_" and the digits of value to out, without allocating */
+inline void append(std::string& out, int64_t value) {
+    char digits[20];
+    int64_t count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value = value / 10;
+    } while (value);
+
+    out.push_back('_');
+    while (count) { out.push_back(digits[--count]); }
+}
+
+inline std::string stub(std::vector<int64_t> const& indices) {
+    std::string result;
+    for (auto const& index : indices)
+        append(result, index);
+
+    return result;
+}
+
+/* shape from the title of a saved descriptor */
+inline std::vector<int64_t> shape_of(std::string desc) {
+    std::vector<int64_t> shape;
+    while (!desc.empty()) {
+        desc.erase(0, 1);
+
+        auto pos = desc.find("_");
+        auto token = desc.substr(0, pos);
+        shape.push_back(std::atoi(token.data()));
+
+        desc.erase(0, pos);
+    }
+
+    return shape;
+}
+
+template <typename T>
+int64_t flatten(std::vector<int64_t> const& shape, T const& indices) {
+    int64_t index = 0;
+    int64_t block = 1;
+    auto x = std::begin(indices);
+    for (auto const& axis : shape) {
+        index = index + (*x) * block;
+        block = block * axis;
+        std::advance(x, 1);
+    }
+
+    return index;
+}
+
+/* write into caller-provided storage of size >= shape.size() */
+template <typename T>
+void unravel(std::vector<int64_t> const& shape, int64_t index, T& indices) {
+    for (std::size_t i = 0; i < shape.size(); ++i) {
+        indices[i] = index % shape[i];
+        index = index / shape[i];
+    }
+}
+
+/* tag followed by the indices of cell index, written into out. reuses
+ * the storage of out, so repeated calls do not allocate */
+inline void format(std::string& out, std::string const& tag,
+                   std::vector<int64_t> const& shape, int64_t index) {
+    out.assign(tag);
+    for (auto const& axis : shape) {
+        append(out, index % axis);
+        index = index / axis;
+    }
+}
+
+/* a history owns its cells: they are released (see dispose) with it, or
+ * handed over with release(). cells assigned through operator[] are owned
+ * as well, and must not also be owned by a directory */
 template <typename H>
 class history {
   public:
@@ -36,14 +188,15 @@ class history {
             std::function<H*(int64_t,
                              std::string const&,
                              std::string const&)> factory,
-            T<int64_t> const& shape)
+            T<int64_t> const& shape, booking mode = booking::eager)
             : _tag(tag),
               _label(label),
               _dims(shape.size()),
               _size(std::accumulate(std::begin(shape), std::end(shape), 1,
                                     std::multiplies<int64_t>())),
               _shape(std::vector<int64_t>(std::begin(shape), std::end(shape))),
-              _factory(factory) {
+              _factory(factory),
+              _booking(mode) {
         allocate_objects();
     }
 
@@ -65,27 +218,31 @@ class history {
     }
 
     history(TFile* f, std::string const& tag)
-            : _tag(tag) {
-        std::string desc = ((TNamed*)f->Get(tag.data()))->GetTitle();
-        while (!desc.empty()) {
-            desc.erase(0, 1);
-
-            auto pos = desc.find("_");
-            auto token = desc.substr(0, pos);
-            _shape.push_back(std::atoi(token.data()));
-
-            desc.erase(0, pos);
-        }
+            : history(f, tag, selection { 0, -1 }) {
+    }
 
+    /* reads either layout; cells outside the selection are left null */
+    history(TFile* f, std::string const& tag, selection cells)
+            : _tag(tag) {
+        auto record = (TNamed*)f->Get(tag.data());
+        _shape = shape_of(record->GetTitle());
         _dims = _shape.size();
         _size = std::accumulate(std::begin(_shape), std::end(_shape), 1,
                                 std::multiplies<int64_t>());
 
         objects = std::vector<H*>(_size, nullptr);
-        for (int64_t i = 0; i < _size; ++i) {
-            auto name = _tag + stub(i);
-            objects[i] = (H*)f->Get(name.data());
-            objects[i]->SetName(name.data());
+
+        int64_t first = std::max<int64_t>(cells.first, 0);
+        int64_t last = cells.last < 0 ? _size : std::min(cells.last, _size);
+
+        if (record->InheritsFrom("TTree")) {
+            unpack(static_cast<TTree*>(record), first, last); return; }
+
+        std::string name;
+        for (int64_t i = first; i < last; ++i) {
+            format(name, _tag, _shape, i);
+            objects[i] = detach((H*)f->Get(name.data()));
+            if (objects[i]) { objects[i]->SetName(name.data()); }
         }
     }
 
@@ -101,11 +258,10 @@ class history {
               _dims(other._dims),
               _size(other._size),
               _shape(other._shape),
-              _factory(other._factory) {
+              _factory(other._factory),
+              _booking(other._booking) {
         for (auto const& obj : other.objects)
-            objects.push_back((H*)obj->Clone());
-
-        rename();
+            objects.push_back(obj ? detach((H*)obj->Clone()) : nullptr);
     }
 
     history(history const& other, std::string const& old,
@@ -117,77 +273,126 @@ class history {
     history(history const&) = delete;
     history& operator=(history const&) = delete;
     history(history&&) = default;
-    history& operator=(history&&) = default;
-    ~history() = default;
+
+    history& operator=(history&& other) {
+        if (this == &other) { return *this; }
+
+        clear();
+        _tag = std::move(other._tag);
+        _label = std::move(other._label);
+        _dims = other._dims;
+        _size = other._size;
+        _shape = std::move(other._shape);
+        _factory = std::move(other._factory);
+        _booking = other._booking;
+        objects = std::move(other.objects);
+        other.objects.clear();
+        _generations = std::move(other._generations);
+        _clock = other._clock;
+        _memos = std::move(other._memos);
+
+        return *this;
+    }
+
+    ~history() { clear(); }
+
+    /* give up ownership of the cells, leaving them null */
+    std::vector<H*> release() {
+        std::vector<H*> result(_size, nullptr);
+        std::swap(result, objects);
+        mark();
+
+        return result;
+    }
 
     template <template <typename...> class T, typename U>
     typename std::enable_if<std::is_integral<U>::value, int64_t>::type
     index_for(T<U> const& indices) const {
-        int64_t index = 0;
-        int64_t block = 1;
-        auto x = std::begin(indices);
-        for (auto const& axis : _shape) {
-            index = index + (*x) * block;
-            block = block * axis;
-            std::advance(x, 1);
-        }
+        return flatten(_shape, indices); }
 
-        return index;
-    }
+    template <typename U, std::size_t N>
+    typename std::enable_if<std::is_integral<U>::value, int64_t>::type
+    index_for(std::array<U, N> const& indices) const {
+        return flatten(_shape, indices); }
 
     std::vector<int64_t> indices_for(int64_t index) const {
         std::vector<int64_t> indices(_dims);
-        for (int64_t i = 0; i < _dims; ++i) {
-            indices[i] = index % _shape[i];
-            index = index / _shape[i];
-        }
+        indices_for(index, indices);
 
         return indices;
     }
 
+    /* write into caller-provided storage of size >= dims() */
+    template <typename T>
+    void indices_for(int64_t index, T& indices) const {
+        unravel(_shape, index, indices); }
+
     void add(history const& other, double c1) {
-        for (int64_t i = 0; i < _size; ++i)
-            objects[i]->Add(other[i], c1);
+        execution serial; add(serial, other, c1); }
+
+    void add(execution& exec, history const& other, double c1) {
+        exec.run(_size, [&](int64_t i) {
+            if (other[i]) { touch(i, other[i])->Add(other[i], c1); } });
+    }
+
+    /* add shards into self by pairwise tree reduction in a fixed order, so
+     * the result does not depend on which thread filled which shard. the
+     * shards are used as scratch space */
+    template <typename T>
+    void merge(std::vector<T*> const& shards) {
+        int64_t count = shards.size();
+        for (int64_t stride = 1; stride < count; stride = stride * 2)
+            for (int64_t i = 0; i + stride < count; i = i + 2 * stride)
+                shards[i]->add(*shards[i + stride], 1);
+
+        if (count) { add(*shards[0], 1); }
     }
 
     void operator+=(history const& other) { add(other, 1); }
     void operator-=(history const& other) { add(other, -1); }
 
-    void scale(double c1) {
+    void reset() {
         for (auto const& obj : objects)
-            obj->Scale(c1);
+            if (obj) { obj->Reset("MICES"); }
+
+        mark();
     }
 
-    void operator*=(double c1) { scale(c1); }
-    void operator/=(double c1) { scale(1. / c1); }
+    /* empty copy to be filled from a single worker thread. call from the
+     * thread that owns the original: cloning touches ROOT global state */
+    history* shard(int64_t id) const {
+        auto result = new history(*this, "shard" + std::to_string(id));
+        result->reset();
 
-    /* scale histograms by counts from other. assume self, other have identical
-     * shapes for overlapping dimensions */
-    void multiply(history const& other) {
-        /* warning: fails silently! */
-        if (!compatible(other)) { return; }
+        return result;
+    }
 
-        std::vector<int64_t> axes(_dims - other._dims);
-        std::iota(std::begin(axes), std::end(axes), other._dims);
+    void scale(double c1) {
+        execution serial; scale(serial, c1); }
 
-        return multiply(other, axes);
+    void scale(execution& exec, double c1) {
+        exec.run(_size, [&](int64_t i) {
+            if (objects[i]) { objects[i]->Scale(c1); mark(i); } });
     }
 
-    void divide(history const& other) {
-        /* warning: fails silently! */
-        if (!compatible(other)) { return; }
+    void operator*=(double c1) { scale(c1); }
+    void operator/=(double c1) { scale(1. / c1); }
 
-        std::vector<int64_t> axes(_dims - other._dims);
-        std::iota(std::begin(axes), std::end(axes), other._dims);
+    /* scale histograms by counts from other, broadcast over the trailing
+     * dimensions of self. throws std::invalid_argument unless self, other
+     * have identical shapes for overlapping dimensions */
+    void multiply(history const& other) {
+        return multiply(other, trailing(other)); }
 
-        return divide(other, axes);
-    }
+    void divide(history const& other) {
+        return divide(other, trailing(other)); }
 
     void operator*=(history const& other) { multiply(other); }
     void operator/=(history const& other) { divide(other); }
 
-    /* scale histograms integrated along axes. assume self, other have equal
-     * shapes after integrating out axes */
+    /* scale histograms integrated along axes (ascending). throws
+     * std::invalid_argument unless self, other have equal shapes after
+     * integrating out axes */
     template <template <typename...> class T>
     void multiply(history const& other, T<int64_t> axes) {
         scale(other, axes, [](float content) -> float {
@@ -200,54 +405,125 @@ class history {
             return content != 0 ? 1. / content : 0; });
     }
 
-    H*& operator[](int64_t index) { return objects[index]; }
+    H*& operator[](int64_t index) { return touch(index); }
     H* const& operator[](int64_t index) const { return objects[index]; }
 
     template <template <typename...> class T, typename U>
     H*& operator[](T<U> const& indices) {
-        return objects[index_for(indices)]; }
+        return touch(index_for(indices)); }
 
     template <template <typename...> class T, typename U>
     H* const& operator[](T<U> const& indices) const {
         return objects[index_for(indices)]; }
 
+    template <typename U, std::size_t N>
+    H*& operator[](std::array<U, N> const& indices) {
+        return touch(index_for(indices)); }
+
+    template <typename U, std::size_t N>
+    H* const& operator[](std::array<U, N> const& indices) const {
+        return objects[index_for(indices)]; }
+
+    /* null if every cell along axis is missing */
     H* sum(std::vector<int64_t> indices, int64_t axis) const {
         std::vector<int64_t> output = indices;
         output.erase(std::next(std::begin(output), axis));
 
-        auto name = _tag + "_sum" + std::to_string(axis) + stub(output);
-        auto sum = static_cast<H*>((*this)[indices]->Clone(name.data()));
-
-        sum->Reset("MICES");
+        H* sum = nullptr;
         for (int64_t i = 0; i < _shape[axis]; ++i) {
             indices[axis] = i;
-            sum->Add((*this)[indices]);
+            auto obj = (*this)[indices];
+            if (!obj) { continue; }
+
+            if (!sum) {
+                auto name = _tag + "_sum" + std::to_string(axis)
+                    + stub(output);
+                sum = detach(static_cast<H*>(obj->Clone(name.data())));
+                sum->Reset("MICES");
+            }
+
+            sum->Add(obj);
         }
 
         return sum;
     }
 
     history* sum(int64_t axis) const {
-        std::vector<int64_t> output = _shape;
-        output.erase(std::next(std::begin(output), axis));
+        execution serial; return sum(serial, axis); }
 
-        if (output.empty()) { output.push_back(1); }
-
-        auto result = new history(_tag + "_sum" + std::to_string(axis),
-                                  _label, output);
+    history* sum(execution& exec, int64_t axis) const {
+        return reduce(exec, _tag + "_sum" + std::to_string(axis), { axis },
+                      reduction::sum);
+    }
 
-        for (int64_t i = 0; i < result->size(); ++i) {
-            auto indices = result->indices_for(i);
-            indices.insert(std::next(std::begin(indices), axis), 0);
-            (*result)[i] = this->sum(indices, axis);
+    /* axes are numbered as after summing the preceding ones, as for
+     * sum(axis)->sum(axes...), but reduced in a single pass */
+    template <typename... T>
+    history* sum(int64_t axis, T... axes) const {
+        std::vector<int64_t> chain = { axis, axes... };
+        std::vector<int64_t> remaining(_dims);
+        std::iota(std::begin(remaining), std::end(remaining), 0);
+
+        auto tag = _tag;
+        std::vector<int64_t> original;
+        for (auto const& a : chain) {
+            tag = tag + "_sum" + std::to_string(a);
+            original.push_back(remaining[a]);
+            remaining.erase(std::next(std::begin(remaining), a));
         }
 
-        return result;
+        execution serial;
+        return reduce(serial, tag, original, reduction::sum);
     }
 
-    template <typename... T>
-    history* sum(int64_t axis, T... axes) const {
-        return sum(axis)->sum(axes...); }
+    history* sum(std::vector<int64_t> const& axes) const {
+        execution serial; return sum(serial, axes); }
+
+    history* sum(execution& exec, std::vector<int64_t> const& axes) const {
+        return reduce(exec, _tag + suffix("_sum", axes), axes,
+                      reduction::sum);
+    }
+
+    history* mean(std::vector<int64_t> const& axes) const {
+        execution serial; return mean(serial, axes); }
+
+    history* mean(execution& exec, std::vector<int64_t> const& axes) const {
+        return reduce(exec, _tag + suffix("_mean", axes), axes,
+                      reduction::mean);
+    }
+
+    /* reduce over axes (original numbering, in any order, each at most
+     * once) in one pass, writing straight into the output cells, which are
+     * computed in parallel. inputs of each output cell are added in
+     * flat-index order. weights, if given, hold one vector per reduced axis,
+     * in the order of axes; each input is weighted by the product of its
+     * entries. a mean divides the sum by the sum of the weights of all
+     * inputs (by their number, without weights). missing cells count as
+     * empty; an output cell is null when all of its inputs are missing */
+    history* reduce(execution& exec, std::string const& tag,
+                    std::vector<int64_t> const& axes, reduction kind,
+                    std::vector<std::vector<double>> const& weights = {})
+            const {
+        /* check axes before booking the result */
+        order(axes, weights);
+
+        std::vector<bool> reduced(_dims, false);
+        for (auto const& axis : axes) { reduced[axis] = true; }
+
+        std::vector<int64_t> output;
+        for (int64_t i = 0; i < _dims; ++i)
+            if (!reduced[i]) { output.push_back(_shape[i]); }
+
+        if (output.empty()) { output.push_back(1); }
+
+        std::unique_ptr<history> result(new history(tag, _label, output));
+
+        std::vector<int64_t> cells(result->size());
+        std::iota(std::begin(cells), std::end(cells), 0);
+        reduce_into(exec, *result, cells, axes, kind, weights);
+
+        return result.release();
+    }
 
     history* extend(std::string const& prefix, int64_t axis, int64_t size) {
         auto shape = std::vector<int64_t>(_shape);
@@ -255,58 +531,120 @@ class history {
 
         auto result = new history(prefix + "_" + _tag, _label, shape);
 
+        std::vector<int64_t> indices(_dims + 1);
+        auto shifted = std::next(std::begin(indices), axis);
         for (int64_t i = 0; i < _size; ++i) {
-            auto indices = indices_for(i);
-            indices.insert(std::next(std::begin(indices), axis), 0);
+            indices_for(i, indices);
+            std::copy_backward(shifted, std::prev(std::end(indices)),
+                               std::end(indices));
 
             for (int64_t j = 0; j < size; ++j) {
                 indices[axis] = j;
-                (*result)[indices] = (H*)objects[i]->Clone();
+                (*result)[indices] = objects[i]
+                    ? detach((H*)objects[i]->Clone()) : nullptr;
             }
         }
 
-        result->rename();
-
         return result;
     }
 
+    /* cells in [offset, offset + shape) along each axis, in one pass that
+     * clones only the cells kept. history_view selects them without
+     * copies */
     history* shrink(std::string const& tag,
                     std::vector<int64_t> const& shape,
                     std::vector<int64_t> const& offset) const {
-        auto result = new history(*this, tag);
-
-        std::vector<int64_t> out;
-        std::function<void(std::vector<int64_t> const&)> recorder =
-                [&](std::vector<int64_t> const& indices) {
-            for (int64_t j = 0; j < _dims; ++j) {
-                if (indices[j] >= shape[j] + offset[j]
-                        || indices[j] < offset[j])
-                    out.push_back(index_for(indices));
-            }
-        };
+        auto result = new history(tag + "_" + _tag, _label, shape);
+        result->_factory = _factory;
+        result->_booking = _booking;
 
-        std::vector<int64_t> zero(_dims, 0);
-        std::vector<int64_t> axes(_dims);
-        std::iota(std::begin(axes), std::end(axes), 0);
+        std::vector<int64_t> cells(result->_size);
+        std::iota(std::begin(cells), std::end(cells), 0);
+        copy_into(*result, cells, offset, 1.);
 
-        permute(recorder, zero, _shape, axes, 0);
+        return result;
+    }
 
-        auto ref = std::begin(result->objects);
-        for (auto it = std::rbegin(out); it != std::rend(out); ++it)
-            result->objects.erase(std::next(ref, *it));
+    /* results cached by the history, keyed by operation and arguments. each
+     * call brings its result up to date, recomputing only the output cells
+     * whose inputs changed since the last call (see generation). results
+     * stay owned by the history, and valid until forget(). calls change the
+     * cache, so they are not const, and must not run concurrently with each
+     * other or with changes to the history */
+    history const& cached_sum(std::vector<int64_t> const& axes) {
+        return memoise("sum" + stub(axes), [&]() {
+            return sum(axes);
+        }, [&](history& result, std::vector<int64_t> const& changed) {
+            std::vector<int64_t> cells;
+            for (auto index : changed)
+                cells.push_back(project(index, axes));
+
+            std::sort(std::begin(cells), std::end(cells));
+            cells.erase(std::unique(std::begin(cells), std::end(cells)),
+                        std::end(cells));
+
+            execution serial;
+            reduce_into(serial, result, cells, axes, reduction::sum, {});
+        });
+    }
 
-        result->_shape = shape;
-        result->_size = std::accumulate(std::begin(shape), std::end(shape), 1,
-                                        std::multiplies<int64_t>());
+    history const& cached_shrink(std::vector<int64_t> const& shape,
+                                 std::vector<int64_t> const& offset) {
+        return memoise("shrink" + stub(shape) + stub(offset), [&]() {
+            return shrink("shrink", shape, offset);
+        }, [&](history& result, std::vector<int64_t> const& changed) {
+            std::vector<int64_t> cells;
+            std::vector<int64_t> indices(_dims);
+            for (auto index : changed) {
+                indices_for(index, indices);
+
+                bool inside = true;
+                for (int64_t j = 0; j < _dims; ++j) {
+                    indices[j] = indices[j] - offset[j];
+                    inside = inside && indices[j] >= 0
+                        && indices[j] < shape[j];
+                }
+
+                if (inside) { cells.push_back(result.index_for(indices)); }
+            }
 
-        result->rename();
+            copy_into(result, cells, offset, 1.);
+        });
+    }
 
-        return result;
+    /* copy with every cell scaled by c1, e.g. normalised to a luminosity */
+    history const& cached_scale(double c1) {
+        uint64_t bits;
+        std::memcpy(&bits, &c1, sizeof(bits));
+
+        return memoise("scale_" + std::to_string(bits), [&]() {
+            auto result = new history(_tag + "_scaled", _label, _shape);
+
+            std::vector<int64_t> cells(_size);
+            std::iota(std::begin(cells), std::end(cells), 0);
+            copy_into(*result, cells, std::vector<int64_t>(_dims, 0), c1);
+
+            return result;
+        }, [&](history& result, std::vector<int64_t> const& changed) {
+            copy_into(result, changed, std::vector<int64_t>(_dims, 0), c1);
+        });
     }
 
+    /* drop all cached results */
+    void forget() { _memos.clear(); }
+
+    /* last change to a cell, counted once a result has been cached. changes
+     * through non-const access, add, scale, multiply, divide, reset, apply
+     * and fill_batch are seen; changes through const access are not.
+     * non-const access marks the cell when it is taken, before the write:
+     * a pointer kept from earlier access and written after a cached call
+     * leaves the cache stale, so take cells through operator[] each time */
+    uint64_t generation(int64_t index) const {
+        return _generations.empty() ? 0 : _generations[index]; }
+
     template <typename T, typename... U>
     T operator()(int64_t index, T (H::* fn)(U...), U... args) {
-        return forward(index, fn, args...); }
+        touch(index); return forward(index, fn, args...); }
 
     template <typename T, typename... U>
     T operator()(int64_t index, T (H::* fn)(U...) const, U... args) const {
@@ -315,7 +653,8 @@ class history {
     template <typename T, template <typename...> class U, typename V,
               typename... W>
     T operator()(U<V> const& indices, T (H::* fn)(W...), W... args) {
-        return forward(index_for(indices), fn, args...); }
+        auto index = index_for(indices);
+        touch(index); return forward(index, fn, args...); }
 
     template <typename T, template <typename...> class U, typename V,
               typename... W>
@@ -323,17 +662,85 @@ class history {
                  W... args) const {
         return forward(index_for(indices), fn, args...); }
 
+    /* fill a batch of entries, grouped by cell so that each histogram is
+     * filled once through FillN. entries with indices outside [0, size) are
+     * skipped; entries keep their relative order within a cell */
+    template <typename... T>
+    void fill_batch(int64_t count, int64_t const* indices,
+                    double const* weights, T const*... observables) {
+        instrument::timer timer(phase::fill);
+
+        std::vector<int64_t> order;
+        order.reserve(count);
+        for (int64_t i = 0; i < count; ++i) {
+            instrument::filled(this, _size, indices[i]);
+            if (indices[i] >= 0 && indices[i] < _size)
+                order.push_back(i);
+        }
+
+        std::stable_sort(std::begin(order), std::end(order),
+            [&](int64_t a, int64_t b) { return indices[a] < indices[b]; });
+
+        int64_t total = order.size();
+        std::array<double const*, sizeof...(T)> sources = {{ observables... }};
+        std::array<std::vector<double>, sizeof...(T)> columns;
+        for (std::size_t j = 0; j < sizeof...(T); ++j) {
+            columns[j].resize(total);
+            for (int64_t i = 0; i < total; ++i)
+                columns[j][i] = sources[j][order[i]];
+        }
+
+        std::vector<double> w(weights ? total : 0);
+        for (int64_t i = 0; i < static_cast<int64_t>(w.size()); ++i)
+            w[i] = weights[order[i]];
+
+        for (int64_t first = 0, last = 0; first < total; first = last) {
+            auto index = indices[order[first]];
+            while (last < total && indices[order[last]] == index) { ++last; }
+
+            fill_cell(touch(index), first, last - first, columns,
+                      weights ? w.data() + first : nullptr,
+                      std::index_sequence_for<T...>());
+        }
+    }
+
+    /* missing (lazily unbooked) cells are skipped */
     void apply(std::function<void(H*)> f) {
-        for (auto& obj : objects) { f(obj); } }
+        for (int64_t i = 0; i < _size; ++i) {
+            if (objects[i]) { f(objects[i]); mark(i); } }
+    }
 
     void apply(std::function<void(H*, int64_t)> f) {
-        for (int64_t i = 0; i < _size; ++i) { f(objects[i], i); } }
+        for (int64_t i = 0; i < _size; ++i) {
+            if (objects[i]) { f(objects[i], i); mark(i); } }
+    }
+
+    void apply(execution& exec, std::function<void(H*)> f) {
+        exec.run(_size, [&](int64_t i) {
+            if (objects[i]) { f(objects[i]); mark(i); } });
+    }
+
+    void apply(execution& exec, std::function<void(H*, int64_t)> f) {
+        exec.run(_size, [&](int64_t i) {
+            if (objects[i]) { f(objects[i], i); mark(i); } });
+    }
 
+    /* cells are named here, just before they are written */
     void save(std::string const& prefix) const {
+        instrument::timer timer(phase::save);
+
         auto full = prefix.empty() ? "" : prefix + "_";
-        for (auto const& obj : objects) {
-            auto name = full + obj->GetName();
-            obj->Write(name.data(), TObject::kOverwrite);
+
+        std::string name;
+        std::string key;
+        for (int64_t i = 0; i < _size; ++i) {
+            if (!objects[i]) { continue; }
+
+            format(name, _tag, _shape, i);
+            objects[i]->SetName(name.data());
+
+            key.assign(full).append(name);
+            objects[i]->Write(key.data(), TObject::kOverwrite);
         }
 
         auto label = new TNamed((full + _tag).data(), stub(_shape).data());
@@ -342,28 +749,271 @@ class history {
 
     void save() const { save(""); }
 
-    void rename(std::string const& old, std::string const& tag) {
-        _tag.replace(_tag.find(old), old.length(), tag); rename(); }
+    void save(std::string const& prefix, layout mode) const {
+        if (mode == layout::objects) { save(prefix); return; }
 
-    void rename(std::string const& tag) {
-        _tag = tag; rename(); }
+        instrument::timer timer(phase::save);
 
-    void rename() {
+        auto full = prefix.empty() ? "" : prefix + "_";
+
+        std::vector<int64_t> present;
         for (int64_t i = 0; i < _size; ++i)
-            objects[i]->SetName((_tag + stub(i)).data());
+            if (objects[i]) { present.push_back(i); }
+
+        H* prototype = nullptr;
+        Int_t bins = 0;
+        if (!present.empty()) {
+            auto first = objects[present[0]];
+            prototype = static_cast<H*>(first->Clone("prototype"));
+            prototype->Reset("MICES");
+            prototype->SetDirectory(nullptr);
+            bins = prototype->GetNcells();
+        }
+
+        pack(full + _tag, stub(_shape), prototype, bins, present.size(),
+             [&](int64_t k, Long64_t& index, double* contents,
+                 double* errors, double& entries) {
+            index = present[k];
+
+            auto obj = objects[index];
+            for (Int_t j = 0; j < bins; ++j) {
+                contents[j] = obj->GetBinContent(j);
+                errors[j] = obj->GetBinError(j);
+            }
+
+            entries = obj->GetEntries();
+        });
+    }
+
+    /* cell names are generated lazily (on save, or through name), so
+     * renaming does not touch the cells */
+    void rename(std::string const& old, std::string const& tag) {
+        _tag.replace(_tag.find(old), old.length(), tag); }
+
+    void rename(std::string const& tag) { _tag = tag; }
+
+    /* apply current names to all cells */
+    void rename() const {
+        std::string name;
+        for (int64_t i = 0; i < _size; ++i) {
+            if (!objects[i]) { continue; }
+
+            format(name, _tag, _shape, i);
+            objects[i]->SetName(name.data());
+        }
+    }
+
+    std::string name(int64_t index) const {
+        std::string result;
+        format(result, _tag, _shape, index);
+
+        return result;
     }
 
     template <typename... T>
     void saveas(T const&... args) { rename(args...); save(); }
 
     template <typename... T>
-    void saveby(T const&... args) { rename(); save(args...); }
+    void saveby(T const&... args) { save(args...); }
 
+    std::string const& tag() const { return _tag; }
+    std::string const& label() const { return _label; }
     int64_t const& dims() const { return _dims; }
     int64_t const& size() const { return _size; }
     std::vector<int64_t> const& shape() const { return _shape; }
 
   protected:
+    /* axes in ascending order, with their weights (if any) in the same
+     * order. throws on axes out of range or repeated, and on weights not
+     * matching the extents of their axes */
+    std::pair<std::vector<int64_t>, std::vector<std::vector<double>>>
+    order(std::vector<int64_t> const& axes,
+          std::vector<std::vector<double>> const& weights) const {
+        if (!weights.empty() && weights.size() != axes.size()) {
+            throw std::invalid_argument(
+                "history: one weight vector per reduced axis of " + _tag); }
+
+        std::vector<int64_t> positions(axes.size());
+        std::iota(std::begin(positions), std::end(positions), 0);
+        std::sort(std::begin(positions), std::end(positions),
+                  [&](int64_t a, int64_t b) { return axes[a] < axes[b]; });
+
+        std::pair<std::vector<int64_t>, std::vector<std::vector<double>>>
+            result;
+        for (auto position : positions) {
+            auto axis = axes[position];
+            if (axis < 0 || axis >= _dims
+                    || (!result.first.empty() && result.first.back() == axis)) {
+                throw std::invalid_argument(
+                    "history: axis " + std::to_string(axis)
+                    + " out of range or repeated for " + _tag + stub(_shape));
+            }
+
+            if (!weights.empty() && static_cast<int64_t>(
+                    weights[position].size()) != _shape[axis]) {
+                throw std::invalid_argument(
+                    "history: weights for axis " + std::to_string(axis)
+                    + " do not match its extent in " + _tag + stub(_shape));
+            }
+
+            result.first.push_back(axis);
+            if (!weights.empty()) {
+                result.second.push_back(weights[position]); }
+        }
+
+        return result;
+    }
+
+    /* compute the given output cells of result, a reduction over axes (as
+     * in reduce), replacing what they held */
+    void reduce_into(execution& exec, history& result,
+                     std::vector<int64_t> const& cells,
+                     std::vector<int64_t> const& unordered, reduction kind,
+                     std::vector<std::vector<double>> const& unmatched)
+            const {
+        auto ordered = order(unordered, unmatched);
+        auto const& axes = ordered.first;
+        auto const& weights = ordered.second;
+
+        std::vector<int64_t> strides(_dims, 1);
+        for (int64_t i = 1; i < _dims; ++i)
+            strides[i] = strides[i - 1] * _shape[i - 1];
+
+        std::vector<bool> reduced(_dims, false);
+        for (auto const& axis : axes) { reduced[axis] = true; }
+
+        std::vector<int64_t> kept;
+        for (int64_t i = 0; i < _dims; ++i)
+            if (!reduced[i]) { kept.push_back(i); }
+
+        int64_t depth = axes.size();
+        int64_t volume = 1;
+        for (auto const& axis : axes) { volume = volume * _shape[axis]; }
+
+        /* sum of the weight products over all inputs, for means */
+        double norm = volume;
+        if (!weights.empty()) {
+            norm = 1.;
+            for (auto const& each : weights)
+                norm = norm * std::accumulate(std::begin(each),
+                                              std::end(each), 0.);
+        }
+
+        if (kind == reduction::mean && norm == 0.) {
+            throw std::invalid_argument(
+                "history: weights of a mean over " + _tag + " sum to zero"); }
+
+        exec.run(cells.size(), [&](int64_t c) {
+            auto i = cells[c];
+
+            std::vector<int64_t> indices(kept.size());
+            int64_t base = 0;
+            int64_t rest = i;
+            for (std::size_t k = 0; k < kept.size(); ++k) {
+                indices[k] = rest % _shape[kept[k]];
+                rest = rest / _shape[kept[k]];
+                base = base + indices[k] * strides[kept[k]];
+            }
+
+            H* sum = nullptr;
+            std::vector<int64_t> counter(depth, 0);
+            for (int64_t j = 0, offset = 0; j < volume; ++j) {
+                auto obj = objects[base + offset];
+                if (obj) {
+                    double c1 = 1.;
+                    for (int64_t k = 0; k < depth && !weights.empty(); ++k)
+                        c1 = c1 * weights[k][counter[k]];
+
+                    if (!sum) {
+                        sum = detach(static_cast<H*>(obj->Clone()));
+                        sum->Reset("MICES");
+                    }
+
+                    sum->Add(obj, c1);
+                }
+
+                for (int64_t k = 0; k < depth; ++k) {
+                    auto axis = axes[k];
+                    offset = offset + strides[axis];
+                    if (++counter[k] < _shape[axis]) { break; }
+
+                    offset = offset - _shape[axis] * strides[axis];
+                    counter[k] = 0;
+                }
+            }
+
+            if (sum && kind == reduction::mean) { sum->Scale(1. / norm); }
+
+            if (result.objects[i]) { dispose(result.objects[i]); }
+            result.objects[i] = sum;
+            result.mark(i);
+        });
+    }
+
+    /* copy the given cells of result from self, at an offset along each
+     * axis, scaled by c1 unless it is 1 */
+    void copy_into(history& result, std::vector<int64_t> const& cells,
+                   std::vector<int64_t> const& offset, double c1) const {
+        std::vector<int64_t> indices(_dims);
+        for (auto i : cells) {
+            result.indices_for(i, indices);
+            for (int64_t j = 0; j < _dims; ++j)
+                indices[j] = indices[j] + offset[j];
+
+            auto obj = objects[index_for(indices)];
+            if (result.objects[i]) { dispose(result.objects[i]); }
+            result.objects[i] = obj ? detach((H*)obj->Clone()) : nullptr;
+            if (obj && c1 != 1.) { result.objects[i]->Scale(c1); }
+            result.mark(i);
+        }
+    }
+
+    /* flat index of the cell holding index after reducing axes */
+    int64_t project(int64_t index, std::vector<int64_t> const& axes) const {
+        int64_t result = 0;
+        int64_t block = 1;
+        for (int64_t i = 0; i < _dims; ++i) {
+            auto at = index % _shape[i];
+            index = index / _shape[i];
+            if (std::count(std::begin(axes), std::end(axes), i)) { continue; }
+
+            result = result + at * block;
+            block = block * _shape[i];
+        }
+
+        return result;
+    }
+
+    /* result cached under key: made on first use, then brought up to date
+     * by update(result, cells) with the cells changed since */
+    template <typename F, typename G>
+    history const& memoise(std::string const& key, F make, G update) {
+        if (_generations.empty()) { _generations.assign(_size, 0); }
+
+        auto& memo = _memos[key];
+        if (!memo.result) {
+            memo.result.reset(make());
+        } else {
+            std::vector<int64_t> changed;
+            for (int64_t i = 0; i < _size; ++i)
+                if (_generations[i] > memo.stamp) { changed.push_back(i); }
+
+            if (!changed.empty()) { update(*memo.result, changed); }
+        }
+
+        memo.stamp = _clock++;
+        return *memo.result;
+    }
+
+    /* record a change to a cell. free until a result is cached */
+    void mark(int64_t index) {
+        if (_clock) { _generations[index] = _clock; } }
+
+    void mark() {
+        if (_clock) { std::fill(std::begin(_generations),
+                                std::end(_generations), _clock); }
+    }
+
     bool compatible(history const& other) const {
         if (_dims < other._dims) { return false; }
 
@@ -374,47 +1024,86 @@ class history {
         return true;
     }
 
-    template <template <typename...> class T, typename U>
-    void permute(std::function<void(T<U> const&)>& lambda,
-                 std::vector<int64_t>& indices,
-                 std::vector<int64_t> const& shape,
-                 std::vector<int64_t> const& axes,
-                 int64_t index) const {
-        if (index == static_cast<int64_t>(axes.size())) {
-            lambda(indices); return; }
-
-        int64_t axis = axes[index];
-        for (int64_t i = 0; i < shape[axis]; ++i) {
-            indices[axis] = i;
-            permute(lambda, indices, shape, axes, index + 1);
+    std::vector<int64_t> trailing(history const& other) const {
+        if (!compatible(other)) {
+            throw std::invalid_argument(
+                "history: " + other._tag + stub(other._shape)
+                + " does not match leading dimensions of "
+                + _tag + stub(_shape));
         }
+
+        std::vector<int64_t> axes(_dims - other._dims);
+        std::iota(std::begin(axes), std::end(axes), other._dims);
+
+        return axes;
     }
 
-    template <template <typename...> class T>
-    void scale(history const& other, T<int64_t> axes,
-               std::function<float(float)> lambda) {
-        for (int64_t j = 0; j < other.size(); ++j) {
-            auto indices = other.indices_for(j);
-            for (auto const& axis : axes)
-                indices.insert(std::next(std::begin(indices), axis), 0);
-
-            auto scale = lambda(other[j]->GetBinContent(1));
-            std::function<void(std::vector<int64_t> const&)> scaler =
-                    [&](std::vector<int64_t> const& indices) {
-                (*this)[indices]->Scale(scale); };
-
-            permute(scaler, indices, _shape, axes, 0);
+    /* broadcast scale factors from other over axes: one linear sweep over
+     * self, tracking the index into other through a stride table */
+    template <template <typename...> class T, typename F>
+    void scale(history const& other, T<int64_t> const& axes, F lambda) {
+        std::vector<bool> broadcast(_dims, false);
+        std::vector<int64_t> remaining;
+        int64_t previous = -1;
+        for (auto const& axis : axes) {
+            if (axis <= previous || axis >= _dims) {
+                throw std::invalid_argument(
+                    "history: axes must be ascending and within "
+                    + _tag + stub(_shape));
+            }
+
+            broadcast[axis] = true;
+            previous = axis;
         }
-    }
 
-    std::string stub(std::vector<int64_t> const& indices) const {
-        return std::accumulate(std::begin(indices), std::end(indices),
-            std::string(), [](std::string base, int64_t index) {
-                return std::move(base) + "_" + std::to_string(index); });
+        for (int64_t i = 0; i < _dims; ++i)
+            if (!broadcast[i]) { remaining.push_back(_shape[i]); }
+
+        /* all axes integrated out: a single cell, as sum and reduce give */
+        if (remaining.empty()) { remaining.push_back(1); }
+
+        if (remaining != other._shape) {
+            throw std::invalid_argument(
+                "history: " + other._tag + stub(other._shape)
+                + " does not match " + _tag + stub(_shape)
+                + " with axes integrated out");
+        }
+
+        std::vector<float> factors(other._size);
+        for (int64_t j = 0; j < other._size; ++j)
+            factors[j] = lambda(other[j] ? other[j]->GetBinContent(1) : 0);
+
+        /* stride of each axis of self in other (zero if broadcast) */
+        std::vector<int64_t> strides(_dims, 0);
+        for (int64_t i = 0, block = 1; i < _dims; ++i) {
+            if (broadcast[i]) { continue; }
+
+            strides[i] = block;
+            block = block * _shape[i];
+        }
+
+        std::vector<int64_t> counter(_dims, 0);
+        for (int64_t i = 0, j = 0; i < _size; ++i) {
+            if (objects[i]) { objects[i]->Scale(factors[j]); mark(i); }
+
+            for (int64_t k = 0; k < _dims; ++k) {
+                j = j + strides[k];
+                if (++counter[k] < _shape[k]) { break; }
+
+                j = j - _shape[k] * strides[k];
+                counter[k] = 0;
+            }
+        }
     }
 
-    std::string stub(int64_t index) const {
-        return stub(indices_for(index)); }
+    static std::string suffix(std::string const& op,
+                              std::vector<int64_t> const& axes) {
+        std::string result;
+        for (auto const& axis : axes)
+            result = result + op + std::to_string(axis);
+
+        return result;
+    }
 
     template <typename T, typename... U>
     T forward(int64_t index, T (H::* function)(U...), U... args) {
@@ -424,10 +1113,98 @@ class history {
     T forward(int64_t index, T (H::* function)(U...) const, U... args) const {
         return ((*objects[index]).*function)(std::forward<U>(args)...); }
 
+    template <std::size_t N, std::size_t... I>
+    void fill_cell(H* obj, int64_t offset, int64_t count,
+                   std::array<std::vector<double>, N> const& columns,
+                   double const* weights, std::index_sequence<I...>) {
+        obj->FillN(count, (columns[I].data() + offset)..., weights); }
+
+    /* book a missing cell: through the factory if lazy, otherwise as an
+     * empty copy of like (when given) */
+    H*& touch(int64_t index, H const* like = nullptr) {
+        mark(index);
+
+        auto& obj = objects[index];
+        bool lazy = _booking == booking::lazy && _factory;
+        if (obj || !(lazy || like)) { return obj; }
+
+        if (lazy) {
+            instrument::timer timer(phase::booking);
+
+            std::string name;
+            format(name, _tag, _shape, index);
+            obj = detach(_factory(index, name, _label));
+        } else if (like) {
+            obj = detach(static_cast<H*>(like->Clone()));
+            obj->Reset("MICES");
+        }
+
+        return obj;
+    }
+
+    /* cells in [first, last) from a packed record. entries are stored in
+     * ascending flat index, so the first one is found by bisection over the
+     * index branch alone */
+    void unpack(TTree* tree, int64_t first, int64_t last) {
+        auto prototype = static_cast<H*>(tree->GetUserInfo()->At(0));
+        if (!prototype) { return; }
+
+        Long64_t index = 0;
+        Int_t bins = 0;
+        double entries = 0;
+        std::vector<double> contents(prototype->GetNcells());
+        std::vector<double> errors(prototype->GetNcells());
+
+        tree->SetBranchAddress("index", &index);
+        tree->SetBranchAddress("bins", &bins);
+        tree->SetBranchAddress("contents", contents.data());
+        tree->SetBranchAddress("errors", errors.data());
+        tree->SetBranchAddress("entries", &entries);
+        tree->SetCacheSize();
+
+        auto branch = tree->GetBranch("index");
+        Long64_t lower = 0;
+        Long64_t upper = tree->GetEntries();
+        while (lower < upper) {
+            auto middle = lower + (upper - lower) / 2;
+            branch->GetEntry(middle);
+            if (index < first) { lower = middle + 1; } else { upper = middle; }
+        }
+
+        std::string name;
+        for (auto k = lower; k < tree->GetEntries(); ++k) {
+            tree->GetEntry(k);
+            if (index >= last) { break; }
+
+            format(name, _tag, _shape, index);
+            auto obj = detach(static_cast<H*>(prototype->Clone(name.data())));
+            obj->SetContent(contents.data());
+            obj->SetError(errors.data());
+            obj->SetEntries(entries);
+            objects[index] = obj;
+        }
+
+        tree->ResetBranchAddresses();
+    }
+
+    void clear() {
+        for (auto const& obj : objects)
+            if (obj) { dispose(obj); }
+
+        objects.clear();
+    }
+
     void allocate_objects() {
         objects = std::vector<H*>(_size, nullptr);
-        for (int64_t i = 0; i < _size; ++i)
-            objects[i] = _factory(i, _tag + stub(i), _label);
+        if (_booking == booking::lazy) { return; }
+
+        instrument::timer timer(phase::booking);
+
+        std::string name;
+        for (int64_t i = 0; i < _size; ++i) {
+            format(name, _tag, _shape, i);
+            objects[i] = detach(_factory(i, name, _label));
+        }
     }
 
     template <typename... T>
@@ -445,7 +1222,19 @@ class history {
     std::vector<int64_t> _shape;
 
     std::function<H*(int64_t, std::string const&, std::string const&)> _factory;
+    booking _booking = booking::eager;
     std::vector<H*> objects;
+
+    struct memo {
+        std::unique_ptr<history> result;
+        uint64_t stamp;
+    };
+
+    /* per-cell generations, allocated when a result is first cached. the
+     * clock advances each time a cached result is brought up to date */
+    std::vector<uint64_t> _generations;
+    uint64_t _clock = 0;
+    std::map<std::string, memo> _memos;
 };
 
 #endif /* HISTORY_H */
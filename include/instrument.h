@@ -0,0 +1,74 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <vector>
+
+class interval;
+
+enum class phase { lookup, fill, booking, save };
+
+/* totals over all threads. flow holds underflow and overflow counts per
+ * axis; fills holds, per history (by address), fill counts per cell */
+struct report {
+    std::map<interval const*, std::array<int64_t, 2>> flow;
+    std::map<void const*, std::vector<int64_t>> fills;
+
+    std::array<int64_t, 4> calls = { };
+    std::array<double, 4> seconds = { };
+
+    void print(std::ostream& out) const;
+};
+
+/* hot-path instrumentation, compiled in when the library and its users are
+ * built with -DHIST_INSTRUMENT (make INSTRUMENT=1); otherwise every hook is
+ * an empty inline function. events go to thread-local counters, which are
+ * folded together by collect(). collect() and reset() must not run while
+ * other threads are recording, e.g. call them between parallel runs */
+class instrument {
+  public:
+    class timer;
+
+#ifdef HIST_INSTRUMENT
+    static void underflow(interval const* axis);
+    static void overflow(interval const* axis);
+    static void filled(void const* owner, int64_t size, int64_t index);
+    static void elapsed(phase step, double seconds);
+#else
+    static void underflow(interval const*) { }
+    static void overflow(interval const*) { }
+    static void filled(void const*, int64_t, int64_t) { }
+    static void elapsed(phase, double) { }
+#endif
+
+    static report collect();
+    static void reset();
+};
+
+/* times its own scope as one call of a phase */
+class instrument::timer {
+  public:
+#ifdef HIST_INSTRUMENT
+    explicit timer(phase step)
+        : _step(step),
+          _start(std::chrono::steady_clock::now()) {
+    }
+
+    ~timer() {
+        std::chrono::duration<double> span =
+            std::chrono::steady_clock::now() - _start;
+        instrument::elapsed(_step, span.count());
+    }
+
+  private:
+    phase _step;
+    std::chrono::steady_clock::time_point _start;
+#else
+    explicit timer(phase) { }
+#endif
+};
+
+#endif /* INSTRUMENT_H */
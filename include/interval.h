@@ -3,6 +3,7 @@
 
 #include <array>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 class interval {
@@ -12,14 +13,18 @@ class interval {
 
     interval(int64_t number, double min, double max);
 
-    template <template <typename...> class T>
-    interval(std::string const& abscissa, T<float> const& edges)
+    template <template <typename...> class T, typename U, typename =
+              typename std::enable_if<std::is_floating_point<U>::value>::type>
+    interval(std::string const& abscissa, T<U> const& edges)
         : _abscissa(abscissa),
           _size(edges.size() - 1),
-          _edges(std::begin(edges), std::end(edges)) { }
+          _edges(std::begin(edges), std::end(edges)),
+          _uniform(false),
+          _factor(0) { }
 
-    template <template <typename...> class T>
-    interval(T<float> const& edges)
+    template <template <typename...> class T, typename U, typename =
+              typename std::enable_if<std::is_floating_point<U>::value>::type>
+    interval(T<U> const& edges)
         : interval(std::string(), edges) { }
 
     interval(interval const& other) = default;
@@ -27,6 +32,8 @@ class interval {
     ~interval() = default;
 
     int64_t index_for(double value) const;
+    void index_for(double const* values, int64_t* indices,
+                   int64_t count) const;
 
     template <typename T>
     T* book(int64_t, std::string const&, std::string const&) const;
@@ -54,6 +61,11 @@ class interval {
 
     int64_t const _size;
     std::vector<double> _edges;
+
+    /* lookup engine: direct arithmetic for uniform bins, binary search
+     * otherwise */
+    bool _uniform;
+    double _factor;
 };
 
 #endif /* INTERVAL_H */
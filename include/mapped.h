@@ -0,0 +1,155 @@
+#ifndef MAPPED_H
+#define MAPPED_H
+
+#include "history.h"
+#include "multival.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/* read-only history backed by a memory-mapped flat file. the file holds a
+ * fixed header, the axis sizes, the multival axis edges, then bin contents and
+ * errors as [cell][bin] arrays of doubles (under- and overflow included),
+ * each row aligned to 64 bytes. opening maps the file without reading the
+ * bins; processes mapping the same file share its pages */
+class mapped {
+  public:
+    static constexpr int64_t alignment = 64;
+    static constexpr uint64_t version = 2;
+
+    struct header {
+        char magic[8];
+        uint64_t version;
+        int64_t dims;
+        int64_t mode;
+        int64_t size;
+        int64_t bins;
+        int64_t stride;
+        int64_t edges;
+        int64_t contents;
+        int64_t errors;
+        int64_t length;
+    };
+
+    /* header (section offsets) of the file for a given shape */
+    static header prepare(multival const& intervals, int64_t bins);
+
+    explicit mapped(std::string const& path);
+
+    mapped(mapped const&) = delete;
+    mapped& operator=(mapped const&) = delete;
+    ~mapped();
+
+    /* write cells of source (missing cells as zeros) in the mapped format.
+     * throws std::invalid_argument unless source has the shape of intervals,
+     * holds at least one cell and all cells share the same binning. the file
+     * is written to path.tmp and renamed to path, so that processes mapping
+     * the previous file keep reading it intact */
+    template <typename H>
+    static void write(std::string const& path, history<H> const& source,
+                      multival const& intervals) {
+        if (source.shape() != intervals.shape()) {
+            throw std::invalid_argument(
+                "mapped: shape of " + source.tag()
+                + " does not match the intervals"); }
+
+        int64_t bins = 0;
+        for (int64_t i = 0; i < source.size(); ++i) {
+            if (!source[i]) { continue; }
+            if (!bins) { bins = source[i]->GetNcells(); }
+
+            if (source[i]->GetNcells() != bins) {
+                throw std::invalid_argument(
+                    "mapped: cells of " + source.tag() + " differ in binning");
+            }
+        }
+
+        if (!bins) {
+            throw std::invalid_argument(
+                "mapped: no cells in " + source.tag()); }
+
+        auto head = prepare(intervals, bins);
+        std::vector<char> buffer(head.contents);
+        std::memcpy(buffer.data(), &head, sizeof(header));
+
+        auto sizes = reinterpret_cast<int64_t*>(
+            buffer.data() + sizeof(header));
+        auto edges = reinterpret_cast<double*>(buffer.data() + head.edges);
+        for (auto const& axis : intervals.axes()) {
+            *sizes++ = axis.size();
+            edges = std::copy(axis.edges(), axis.edges() + axis.size() + 1,
+                              edges);
+        }
+
+        auto temporary = path + ".tmp";
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(buffer.data(), buffer.size());
+
+        std::vector<double> row(head.stride);
+        for (auto errors : { false, true }) {
+            for (int64_t i = 0; i < head.size; ++i) {
+                std::fill(std::begin(row), std::end(row), 0.);
+                for (int64_t j = 0; source[i] && j < bins; ++j) {
+                    row[j] = errors ? source[i]->GetBinError(j)
+                        : source[i]->GetBinContent(j); }
+
+                out.write(reinterpret_cast<char const*>(row.data()),
+                          row.size() * sizeof(double));
+            }
+        }
+
+        out.close();
+        if (!out || std::rename(temporary.data(), path.data())) {
+            throw std::runtime_error("mapped: cannot write " + path); }
+    }
+
+    template <template <typename...> class T, typename U>
+    typename std::enable_if<std::is_integral<U>::value, int64_t>::type
+    index_for(T<U> const& indices) const {
+        return _intervals.index_for(indices); }
+
+    template <template <typename...> class T, typename U>
+    typename std::enable_if<std::is_floating_point<U>::value, int64_t>::type
+    index_for(T<U> const& values) const {
+        return _intervals.index_for(values); }
+
+    /* bin contents of a cell */
+    double const* operator[](int64_t index) const {
+        return _contents + index * _header->stride; }
+
+    template <template <typename...> class T, typename U>
+    double const* operator[](T<U> const& indices) const {
+        return (*this)[index_for(indices)]; }
+
+    double const* errors(int64_t index) const {
+        return _errors + index * _header->stride; }
+
+    multival const& intervals() const { return _intervals; }
+
+    int64_t dims() const { return _header->dims; }
+    int64_t size() const { return _header->size; }
+    int64_t bins() const { return _header->bins; }
+    std::vector<int64_t> const& shape() const { return _intervals.shape(); }
+
+    /* axes recorded after a header at base */
+    static multival axes(header const* head, char const* base);
+
+  private:
+    int _descriptor;
+    int64_t _length;
+    char const* _base;
+
+    header const* _header;
+    multival _intervals;
+
+    double const* _contents;
+    double const* _errors;
+};
+
+#endif /* MAPPED_H */
@@ -2,8 +2,11 @@
 #define MEMORY_H
 
 #include "history.h"
+#include "instrument.h"
 #include "multival.h"
 
+#include <stdexcept>
+
 template <typename H>
 class memory : public history<H> {
   public:
@@ -11,8 +14,8 @@ class memory : public history<H> {
            std::function<H*(int64_t,
                             std::string const&,
                             std::string const&)> factory,
-           multival const* intervals)
-        : history<H>(tag, label, factory, intervals->shape()),
+           multival const* intervals, booking mode = booking::eager)
+        : history<H>(tag, label, factory, intervals->shape(), mode),
           intervals(intervals) {
     }
 
@@ -35,40 +38,159 @@ class memory : public history<H> {
     memory& operator=(memory const&) = delete;
     memory(memory&&) = delete;
     memory& operator=(memory&&) = delete;
-    ~memory() = default;
+    ~memory() { if (_discard) { dispose(_discard); } }
+
+    memory* shard(int64_t id) const {
+        auto result = new memory(*this, "shard" + std::to_string(id));
+        result->reset();
+
+        return result;
+    }
 
     using history<H>::index_for;
 
     template <template <typename...> class T, typename U>
     typename std::enable_if<std::is_floating_point<U>::value, int64_t>::type
     index_for(T<U> const& values) const {
+        instrument::timer timer(phase::lookup);
+        return intervals->index_for(values); }
+
+    template <typename U, std::size_t N>
+    typename std::enable_if<std::is_floating_point<U>::value, int64_t>::type
+    index_for(std::array<U, N> const& values) const {
+        instrument::timer timer(phase::lookup);
         return intervals->index_for(values); }
 
     using history<H>::operator[];
 
+    /* non-const access by values or indices counts as one fill. with
+     * flow::drop, out-of-range values are counted as dropped and give a
+     * discard cell: fills into it are harmless, and it is never read, saved
+     * or merged. const access gives a null cell instead */
     template <template <typename...> class T, typename U>
     H*& operator[](T<U> const& indices) {
-        return this->objects[index_for(indices)]; }
+        return access(index_for(indices)); }
 
     template <template <typename...> class T, typename U>
     H* const& operator[](T<U> const& indices) const {
-        return this->objects[index_for(indices)]; }
+        auto index = index_for(indices);
+        return index < 0 ? _none : this->objects[index]; }
+
+    template <typename U, std::size_t N>
+    H*& operator[](std::array<U, N> const& indices) {
+        return access(index_for(indices)); }
+
+    template <typename U, std::size_t N>
+    H* const& operator[](std::array<U, N> const& indices) const {
+        auto index = index_for(indices);
+        return index < 0 ? _none : this->objects[index]; }
 
     using history<H>::operator();
 
     template <typename T, template <typename...> class U, typename V,
               typename... W>
     T operator()(U<V> const& indices, T (H::* fn)(W...), W... args) {
-        return forward(index_for(indices), fn, args...); }
+        auto index = index_for(indices);
+        if (index < 0) { ++_dropped; return T(); }
+
+        instrument::filled(this, this->size(), index);
+        this->touch(index);
+
+        instrument::timer timer(phase::fill);
+        return this->forward(index, fn, args...); }
 
     template <typename T, template <typename...> class U, typename V,
               typename... W>
     T operator()(U<V> const& indices, T (H::* fn)(W...) const,
                  W... args) const {
-        return forward(index_for(indices), fn, args...); }
+        auto index = index_for(indices);
+        if (index < 0) { return T(); }
+
+        return this->forward(index, fn, args...); }
+
+    using history<H>::fill_batch;
+
+    /* fill a batch of entries from columnar data: one column of values per
+     * axis of intervals, optional weights (nullptr for unit weights), then
+     * one column per observable passed to FillN. entries out of range on any
+     * axis go to the flow cells with flow::cells, and are otherwise skipped
+     * and counted as dropped */
+    template <typename... T>
+    void fill_batch(int64_t count, std::vector<double const*> const& columns,
+                    double const* weights, T const*... observables) {
+        std::vector<int64_t> indices(count, 0);
+        std::vector<int64_t> local(count);
+
+        {
+            instrument::timer timer(phase::lookup);
+
+            bool cells = intervals->mode() == flow::cells;
+            int64_t block = 1;
+            for (int64_t j = 0; j < intervals->dims(); ++j) {
+                auto const& axis = intervals->axis(j);
+                axis.index_for(columns[j], local.data(), count);
+
+                for (int64_t i = 0; i < count; ++i) {
+                    bool out = !cells && (local[i] < 0
+                                          || local[i] >= axis.size());
+                    indices[i] = out || indices[i] < 0 ? -1
+                        : indices[i] + (local[i] + cells) * block;
+                }
+
+                block = block * intervals->shape()[j];
+            }
+
+            _dropped = _dropped + std::count(std::begin(indices),
+                                             std::end(indices), -1);
+        }
+
+        history<H>::fill_batch(count, indices.data(), weights,
+                               observables...);
+    }
+
+    int64_t dropped() const { return _dropped; }
 
   private:
+    H*& access(int64_t index) {
+        if (index < 0) { ++_dropped; return discard(); }
+
+        instrument::filled(this, this->size(), index);
+        return this->touch(index);
+    }
+
+    /* an empty copy of a cell, detached from every store: factories may
+     * hand out views of real cells (dense::book), so none is used as is.
+     * without any cell yet, one booked through the factory is the model */
+    H*& discard() {
+        if (_discard) { return _discard; }
+
+        H* like = nullptr;
+        for (auto const& obj : this->objects)
+            if (obj) { like = obj; break; }
+
+        H* model = nullptr;
+        if (!like && this->_factory) {
+            model = detach(this->_factory(0, this->_tag + "_dropped",
+                                          this->_label));
+            like = model;
+        }
+
+        if (!like) {
+            throw std::logic_error("memory: no cell to book for dropped "
+                                   "values of " + this->_tag); }
+
+        _discard = detach(static_cast<H*>(like->Clone()));
+        _discard->Reset("MICES");
+        if (model) { dispose(model); }
+
+        return _discard;
+    }
+
     multival const* intervals;
+
+    int64_t _dropped = 0;
+    H* _none = nullptr;
+    H* _discard = nullptr;
 };
 
 #endif /* MEMORY_H */
@@ -0,0 +1,231 @@
+#ifndef MERGER_H
+#define MERGER_H
+
+#include "execution.h"
+#include "history.h"
+
+#include "TFile.h"
+#include "TH1.h"
+#include "TNamed.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* merges a history saved under the same tag by many jobs into one output,
+ * opening batch inputs at a time. cells are merged in windows of at most
+ * budget / batch cells, so no more than budget input cells are in memory at
+ * once; each finished window is written to the output. shapes are checked
+ * against the saved descriptors before any cell is read. with a checkpoint
+ * file, the current window and progress are recorded after every batch, and
+ * a merge of the same inputs resumes from an existing checkpoint */
+template <typename H>
+class merger {
+  public:
+    merger(std::string const& tag, std::vector<std::string> const& inputs,
+           int64_t batch = 16, int64_t budget = 1 << 20)
+            : _tag(tag),
+              _inputs(inputs),
+              _batch(std::max<int64_t>(batch, 1)),
+              _window(std::max<int64_t>(budget / _batch, 1)) {
+        if (_inputs.empty()) {
+            throw std::invalid_argument("merger: no inputs for " + _tag); }
+
+        auto f = open(_inputs[0], "READ");
+        _shape = descriptor(f.get(), _inputs[0]);
+        _size = std::accumulate(std::begin(_shape), std::end(_shape), 1,
+                                std::multiplies<int64_t>());
+    }
+
+    merger(merger const&) = delete;
+    merger& operator=(merger const&) = delete;
+    ~merger() = default;
+
+    /* compare the descriptor of every input, without reading any cells */
+    void check() const {
+        for (auto const& input : _inputs) {
+            auto f = open(input, "READ");
+            verify(descriptor(f.get(), input), input);
+        }
+    }
+
+    void run(std::string const& output, std::string const& checkpoint = "") {
+        execution serial; run(serial, output, checkpoint); }
+
+    /* cells within a window are merged in parallel, each adding the inputs
+     * in the order given */
+    void run(execution& exec, std::string const& output,
+             std::string const& checkpoint = "") {
+        auto status = TH1::AddDirectoryStatus();
+        TH1::AddDirectory(false);
+
+        try {
+            merge(exec, output, checkpoint);
+        } catch (...) {
+            TH1::AddDirectory(status);
+            throw;
+        }
+
+        TH1::AddDirectory(status);
+    }
+
+    std::vector<int64_t> const& shape() const { return _shape; }
+
+  private:
+    void merge(execution& exec, std::string const& output,
+               std::string const& checkpoint) {
+        history<H> total(_tag, "", _shape);
+
+        int64_t first = 0;
+        int64_t last = std::min(_window, _size);
+        int64_t done = 0;
+
+        if (!checkpoint.empty() && std::ifstream(checkpoint).good()) {
+            resume(checkpoint, total, first, last, done);
+        } else {
+            open(output, "RECREATE");
+        }
+
+        int64_t count = _inputs.size();
+        while (first < _size) {
+            while (done < count) {
+                done = add(exec, total, first, last, done);
+                if (!checkpoint.empty())
+                    record(checkpoint, total, first, last, done);
+            }
+
+            auto f = open(output, "UPDATE");
+            total.save();
+            f->Close();
+
+            for (int64_t i = first; i < last; ++i) {
+                dispose(total[i]);
+                total[i] = nullptr;
+            }
+
+            first = last;
+            last = std::min(first + _window, _size);
+            done = 0;
+
+            if (!checkpoint.empty() && first < _size)
+                record(checkpoint, total, first, last, done);
+        }
+
+        if (!checkpoint.empty()) { std::remove(checkpoint.data()); }
+    }
+
+    /* add cells [first, last) of the next batch of inputs after done; cells
+     * read from the inputs are moved into total or deleted once added */
+    int64_t add(execution& exec, history<H>& total, int64_t first,
+                int64_t last, int64_t done) const {
+        int64_t end = std::min<int64_t>(done + _batch, _inputs.size());
+
+        std::vector<std::unique_ptr<TFile>> files;
+        for (int64_t k = done; k < end; ++k) {
+            files.push_back(open(_inputs[k], "READ"));
+            verify(descriptor(files.back().get(), _inputs[k]), _inputs[k]);
+        }
+
+        std::vector<std::unique_ptr<history<H>>> parts;
+        for (auto const& f : files) {
+            parts.emplace_back(new history<H>(f.get(), _tag,
+                                              selection { first, last }));
+        }
+
+        exec.run(last - first, [&](int64_t k) {
+            auto& obj = total[first + k];
+            for (auto const& part : parts) {
+                auto& cell = (*part)[first + k];
+                if (!cell) { continue; }
+
+                if (obj) { obj->Add(cell); dispose(cell); } else { obj = cell; }
+                cell = nullptr;
+            }
+        });
+
+        return end;
+    }
+
+    /* written to a temporary file and renamed over the checkpoint, so an
+     * interruption leaves either the previous or the new checkpoint */
+    void record(std::string const& checkpoint, history<H> const& total,
+                int64_t first, int64_t last, int64_t done) const {
+        auto temporary = checkpoint + ".tmp";
+        {
+            auto f = open(temporary, "RECREATE");
+            total.save();
+
+            auto progress = std::to_string(first) + " " + std::to_string(last)
+                + " " + std::to_string(done);
+            TNamed((_tag + "_progress").data(), progress.data()).Write();
+            f->Close();
+        }
+
+        if (std::rename(temporary.data(), checkpoint.data())) {
+            throw std::runtime_error("merger: cannot write " + checkpoint); }
+    }
+
+    void resume(std::string const& checkpoint, history<H>& total,
+                int64_t& first, int64_t& last, int64_t& done) const {
+        auto f = open(checkpoint, "READ");
+        verify(descriptor(f.get(), checkpoint), checkpoint);
+
+        auto record = (TNamed*)f->Get((_tag + "_progress").data());
+        if (!record) {
+            throw std::runtime_error("merger: no progress in " + checkpoint); }
+
+        std::istringstream(record->GetTitle()) >> first >> last >> done;
+        delete record;
+
+        history<H> partial(f.get(), _tag, selection { first, last });
+        for (int64_t i = first; i < last; ++i) {
+            total[i] = partial[i];
+            partial[i] = nullptr;
+        }
+    }
+
+    std::vector<int64_t> descriptor(TFile* f, std::string const& path) const {
+        auto record = (TNamed*)f->Get(_tag.data());
+        if (!record) {
+            throw std::runtime_error("merger: no " + _tag + " in " + path); }
+
+        auto shape = shape_of(record->GetTitle());
+        delete record;
+
+        return shape;
+    }
+
+    void verify(std::vector<int64_t> const& shape,
+                std::string const& path) const {
+        if (shape != _shape) {
+            throw std::invalid_argument("merger: shape of " + _tag + " in "
+                                        + path + " differs"); }
+    }
+
+    static std::unique_ptr<TFile> open(std::string const& path,
+                                       char const* option) {
+        std::unique_ptr<TFile> f(TFile::Open(path.data(), option));
+        if (!f || f->IsZombie()) {
+            throw std::runtime_error("merger: cannot open " + path); }
+
+        return f;
+    }
+
+    std::string _tag;
+    std::vector<std::string> _inputs;
+
+    int64_t _batch;
+    int64_t _window;
+
+    int64_t _size;
+    std::vector<int64_t> _shape;
+};
+
+#endif /* MERGER_H */
@@ -1,6 +1,7 @@
 #ifndef MULTIVAL_H
 #define MULTIVAL_H
 
+#include <array>
 #include <iterator>
 #include <numeric>
 #include <type_traits>
@@ -8,16 +9,38 @@
 
 #include "interval.h"
 
+/* handling of values outside an axis. none: the caller guarantees values
+ * are in range. drop: index_for returns -1 if any value is out of range.
+ * cells: each axis gains an underflow (index 0) and an overflow (index
+ * size + 1) slot, so in-range bins start at 1 and shape is size + 2 */
+enum class flow { none, drop, cells };
+
 class multival {
   public:
     template <typename... T>
     multival(T const&... intervals)
-            : _dims(sizeof...(T)) {
+            : multival(flow::none, intervals...) {
+    }
+
+    template <typename... T>
+    multival(flow mode, T const&... intervals)
+            : _dims(sizeof...(T)),
+              _flow(mode) {
         extract(intervals...);
         _size = std::accumulate(std::begin(_shape), std::end(_shape),
                                 1, std::multiplies<int64_t>());
     }
 
+    multival(std::vector<interval> const& intervals, flow mode = flow::none)
+            : _dims(intervals.size()),
+              _flow(mode),
+              _intervals(intervals) {
+        for (auto const& axis : _intervals)
+            _shape.push_back(axis.size() + 2 * (_flow == flow::cells));
+        _size = std::accumulate(std::begin(_shape), std::end(_shape),
+                                1, std::multiplies<int64_t>());
+    }
+
     multival(multival const& other) = default;
     multival& operator=(multival const& other) = default;
     ~multival() = default;
@@ -50,7 +73,38 @@ class multival {
     template <template <typename...> class T, typename U>
     typename std::enable_if<std::is_floating_point<U>::value, int64_t>::type
     index_for(T<U> const& values) const {
-        return index_for(indices_for(values)); }
+        return locate(std::begin(values)); }
+
+    template <typename U, std::size_t N>
+    typename std::enable_if<std::is_integral<U>::value, int64_t>::type
+    index_for(std::array<U, N> const& indices) const {
+        int64_t index = 0;
+        int64_t block = 1;
+        for (std::size_t i = 0; i < N; ++i) {
+            index = index + indices[i] * block;
+            block = block * _shape[i];
+        }
+
+        return index;
+    }
+
+    template <typename U, std::size_t N>
+    typename std::enable_if<std::is_floating_point<U>::value, int64_t>::type
+    index_for(std::array<U, N> const& values) const {
+        int64_t offset = _flow == flow::cells;
+        int64_t index = 0;
+        int64_t block = 1;
+        bool out = false;
+        for (std::size_t i = 0; i < N; ++i) {
+            auto local = _intervals[i].index_for(values[i]);
+            out = out | (static_cast<uint64_t>(local)
+                         >= static_cast<uint64_t>(_intervals[i].size()));
+            index = index + (local + offset) * block;
+            block = block * _shape[i];
+        }
+
+        return out && _flow == flow::drop ? -1 : index;
+    }
 
     template <typename T>
     T* book(int64_t, std::string const&, std::string const&) const;
@@ -62,20 +116,42 @@ class multival {
     std::vector<int64_t> const& shape() const { return _shape; }
     int64_t dims() const { return _dims; }
     int64_t size() const { return _size; }
+    flow mode() const { return _flow; }
 
     interval const& axis(int64_t i) const { return _intervals[i]; }
     std::vector<interval> const& axes() const { return _intervals; }
 
   private:
+    /* single pass over values, no intermediate indices. out-of-range
+     * values are tracked without branching; only the result is checked */
+    template <typename T>
+    int64_t locate(T value) const {
+        int64_t offset = _flow == flow::cells;
+        int64_t index = 0;
+        int64_t block = 1;
+        bool out = false;
+        for (int64_t i = 0; i < _dims; ++i, ++value) {
+            auto local = _intervals[i].index_for(*value);
+            out = out | (static_cast<uint64_t>(local)
+                         >= static_cast<uint64_t>(_intervals[i].size()));
+            index = index + (local + offset) * block;
+            block = block * _shape[i];
+        }
+
+        return out && _flow == flow::drop ? -1 : index;
+    }
+
     template <typename... T>
     void extract(T const&... args) {
         (void) (int [sizeof...(T)]) { (_intervals.emplace_back(args), 0)... };
-        for (auto const& axis : _intervals) { _shape.push_back(axis.size()); }
+        for (auto const& axis : _intervals)
+            _shape.push_back(axis.size() + 2 * (_flow == flow::cells));
     }
 
     std::vector<int64_t> _shape;
     int64_t _dims;
     int64_t _size;
+    flow _flow;
 
     std::vector<interval> _intervals;
 };
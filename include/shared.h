@@ -0,0 +1,159 @@
+#ifndef SHARED_H
+#define SHARED_H
+
+#include "history.h"
+#include "interval.h"
+#include "mapped.h"
+#include "multival.h"
+
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+/* history of one-dimensional cells in a POSIX shared-memory segment, filled
+ * concurrently by any number of processes on a node: every process opens
+ * the segment by name with the same intervals (cells) and axis (bins of
+ * each cell), and fills go straight into the shared bins with lock-free
+ * atomic adds, so there is a single result and nothing to merge. the first
+ * process creates and lays out the segment, the others wait for it to be
+ * ready and check that their layout matches. attaching by name alone maps
+ * the segment read-only, for inspection while it is being filled.
+ *
+ * the segment follows the mapped layout (header, axis sizes and edges,
+ * [cell][bin] rows of contents, then of sums of squared weights instead of
+ * errors), followed by the bin edges and the entries of every cell. it
+ * outlives the processes using it until removed */
+class shared {
+  public:
+    /* header, with the section offsets, of a segment for a given layout */
+    static mapped::header prepare(multival const& intervals,
+                                  interval const& axis);
+
+    /* open the segment for filling, creating it if needed */
+    shared(std::string const& name, multival const& intervals,
+           interval const& axis);
+
+    /* attach to an existing segment read-only */
+    explicit shared(std::string const& name);
+
+    shared(shared const&) = delete;
+    shared& operator=(shared const&) = delete;
+    ~shared();
+
+    /* unlink the segment: processes attached keep it until they detach */
+    static void remove(std::string const& name);
+
+    /* one fill of value, with weight, into a cell. negative indices (out of
+     * range with flow::drop) are ignored, indices past the last cell throw.
+     * with flow::none, values out of range on an axis other than the last
+     * land in a wrong cell, so only drop and cells layouts are safe to fill
+     * by values that are not known to be in range */
+    void fill(int64_t index, double value, double weight = 1.) {
+        if (!_writable) {
+            throw std::logic_error("shared: " + _name + " is read-only"); }
+        if (index < 0) { return; }
+        if (index >= _header->size) {
+            throw std::out_of_range("shared: cell " + std::to_string(index)
+                                    + " out of " + _name); }
+
+        auto offset = index * _header->stride + _axis.index_for(value) + 1;
+        add(_contents[offset], weight);
+        add(_squares[offset], weight * weight);
+        add(_entries[index], 1.);
+    }
+
+    template <template <typename...> class T, typename U>
+    void fill(T<U> const& cell, double value, double weight = 1.) {
+        fill(index_for(cell), value, weight); }
+
+    template <template <typename...> class T, typename U>
+    typename std::enable_if<std::is_integral<U>::value, int64_t>::type
+    index_for(T<U> const& indices) const {
+        return _intervals.index_for(indices); }
+
+    template <template <typename...> class T, typename U>
+    typename std::enable_if<std::is_floating_point<U>::value, int64_t>::type
+    index_for(T<U> const& values) const {
+        return _intervals.index_for(values); }
+
+    /* bins are global bin numbers, flow bins included */
+    double content(int64_t index, int64_t bin) const {
+        return _contents[index * _header->stride + bin].load(
+            std::memory_order_relaxed); }
+
+    double error(int64_t index, int64_t bin) const {
+        return std::sqrt(_squares[index * _header->stride + bin].load(
+            std::memory_order_relaxed)); }
+
+    double entries(int64_t index) const {
+        return _entries[index].load(std::memory_order_relaxed); }
+
+    /* owning copy of the current contents, cells booked from the axis. the
+     * copy of each bin is atomic, not that of the whole segment. the copy
+     * keeps its own axis for later booking, and may outlive the segment */
+    template <typename H>
+    history<H>* materialise(std::string const& tag,
+                            std::string const& ordinate = "") const {
+        auto result = new history<H>(tag, ordinate,
+            [axis = _axis](int64_t, std::string const& name,
+                           std::string const& label) {
+                return detach(axis.book<H>(0, name, label)); }, shape());
+
+        for (int64_t i = 0; i < size(); ++i) {
+            auto obj = (*result)[i];
+            for (int64_t j = 0; j < bins(); ++j) {
+                obj->SetBinContent(j, content(i, j));
+                obj->SetBinError(j, error(i, j));
+            }
+
+            obj->SetEntries(entries(i));
+        }
+
+        return result;
+    }
+
+    multival const& intervals() const { return _intervals; }
+    interval const& axis() const { return _axis; }
+
+    std::string const& name() const { return _name; }
+    bool writable() const { return _writable; }
+
+    int64_t dims() const { return _header->dims; }
+    int64_t size() const { return _header->size; }
+    int64_t bins() const { return _header->bins; }
+    std::vector<int64_t> const& shape() const { return _intervals.shape(); }
+
+  private:
+    static_assert(sizeof(std::atomic<double>) == sizeof(double),
+                  "shared: atomic doubles must be laid out as doubles");
+
+    /* compare-and-swap loop: fetch_add is not defined for doubles */
+    static void add(std::atomic<double>& bin, double value) {
+        auto current = bin.load(std::memory_order_relaxed);
+        while (!bin.compare_exchange_weak(current, current + value,
+                                          std::memory_order_relaxed)) { }
+    }
+
+    shared(std::string const& name, int descriptor, bool writable);
+
+    static interval binning(mapped::header const* head, char const* base);
+
+    std::string _name;
+    bool _writable;
+
+    int _descriptor;
+    int64_t _length;
+    char* _base;
+
+    mapped::header const* _header;
+    multival _intervals;
+    interval _axis;
+
+    std::atomic<double>* _contents;
+    std::atomic<double>* _squares;
+    std::atomic<double>* _entries;
+};
+
+#endif /* SHARED_H */
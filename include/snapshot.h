@@ -0,0 +1,149 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "history.h"
+#include "instrument.h"
+
+#include "TFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* saves a history in the background, in the packed layout. save() copies
+ * the bin contents, errors and entries of every present cell into a buffer
+ * held by the snapshot (plain arrays, no ROOT objects, so the copy is fast)
+ * and returns; a writer thread then serialises the buffer to a TFile,
+ * written to path.tmp and renamed to path once complete. filling can go on
+ * meanwhile. there is only one buffer: save() waits for the previous write
+ * to finish before copying again.
+ *
+ * the copy is consistent if no other thread changes the history during
+ * save(), e.g. call it from the filling thread, or between parallel runs.
+ * writing from a second thread requires ROOT::EnableThreadSafety() */
+template <typename H>
+class snapshot {
+  public:
+    explicit snapshot(history<H> const& source)
+            : _source(&source),
+              _bins(0) {
+    }
+
+    snapshot(snapshot const&) = delete;
+    snapshot& operator=(snapshot const&) = delete;
+    ~snapshot() { wait(); }
+
+    /* the future is ready once path is written, or holds the error */
+    std::future<void> save(std::string const& path,
+                           std::string const& prefix = "") {
+        wait();
+        copy();
+
+        std::promise<void> done;
+        auto result = done.get_future();
+        _writer = std::thread([this, path, prefix](std::promise<void> done) {
+            try {
+                write(path, prefix);
+                done.set_value();
+            } catch (...) {
+                done.set_exception(std::current_exception());
+            }
+        }, std::move(done));
+
+        return result;
+    }
+
+    /* block until the write in progress, if any, is done */
+    void wait() {
+        if (_writer.joinable()) { _writer.join(); } }
+
+  private:
+    /* the buffers are cleared, not released, so that after the first
+     * snapshot copying does not allocate */
+    void copy() {
+        _name = _source->tag();
+        _title.clear();
+        for (auto const& extent : _source->shape())
+            _title.append("_").append(std::to_string(extent));
+
+        _indices.clear();
+        _entries.clear();
+        _contents.clear();
+        _errors.clear();
+        _prototype.reset();
+
+        for (int64_t i = 0; i < _source->size(); ++i) {
+            auto obj = (*_source)[i];
+            if (!obj) { continue; }
+
+            if (!_prototype) {
+                _prototype.reset(detach(static_cast<H*>(
+                    obj->Clone("prototype"))));
+                _prototype->Reset("MICES");
+                _bins = _prototype->GetNcells();
+            }
+
+            if (obj->GetNcells() != _bins) {
+                throw std::invalid_argument(
+                    "snapshot: cells of " + _name + " differ in binning"); }
+
+            _indices.push_back(i);
+            _entries.push_back(obj->GetEntries());
+            for (Int_t j = 0; j < _bins; ++j) {
+                _contents.push_back(obj->GetBinContent(j));
+                _errors.push_back(obj->GetBinError(j));
+            }
+        }
+    }
+
+    void write(std::string const& path, std::string const& prefix) {
+        instrument::timer timer(phase::save);
+
+        auto temporary = path + ".tmp";
+        {
+            std::unique_ptr<TFile> f(TFile::Open(temporary.data(),
+                                                 "RECREATE"));
+            if (!f || f->IsZombie()) {
+                throw std::runtime_error("snapshot: cannot open "
+                                         + temporary); }
+
+            auto full = prefix.empty() ? "" : prefix + "_";
+            pack(full + _name, _title, _prototype.release(), _bins,
+                 _indices.size(), [&](int64_t k, Long64_t& index,
+                                      double* contents, double* errors,
+                                      double& entries) {
+                auto offset = k * _bins;
+                index = _indices[k];
+                entries = _entries[k];
+                std::copy_n(_contents.data() + offset, _bins, contents);
+                std::copy_n(_errors.data() + offset, _bins, errors);
+            });
+
+            f->Close();
+        }
+
+        if (std::rename(temporary.data(), path.data())) {
+            throw std::runtime_error("snapshot: cannot write " + path); }
+    }
+
+    history<H> const* _source;
+    std::thread _writer;
+
+    /* the snapshot buffer: cells in ascending flat index */
+    std::string _name;
+    std::string _title;
+    std::unique_ptr<H> _prototype;
+    Int_t _bins;
+    std::vector<Long64_t> _indices;
+    std::vector<double> _entries;
+    std::vector<double> _contents;
+    std::vector<double> _errors;
+};
+
+#endif /* SNAPSHOT_H */
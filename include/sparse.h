@@ -0,0 +1,366 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "TFile.h"
+#include "TKey.h"
+#include "TList.h"
+#include "TNamed.h"
+#include "TObject.h"
+
+#include "history.h"
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* history-like container for mostly-empty shapes: only occupied cells are
+ * stored, in an open-addressing table keyed by flat index. cells are booked
+ * on first non-const access; missing cells count as empty. memory use and
+ * iteration cost scale with the number of occupied cells. saved files use
+ * the history layout, with missing cells simply absent. cells are owned as
+ * in a history */
+template <typename H>
+class sparse {
+  public:
+    template <template <typename...> class T>
+    sparse(std::string const& tag, std::string const& label,
+           std::function<H*(int64_t,
+                            std::string const&,
+                            std::string const&)> factory,
+           T<int64_t> const& shape)
+            : _tag(tag),
+              _label(label),
+              _dims(shape.size()),
+              _size(std::accumulate(std::begin(shape), std::end(shape), 1,
+                                    std::multiplies<int64_t>())),
+              _shape(std::vector<int64_t>(std::begin(shape), std::end(shape))),
+              _factory(factory),
+              _count(0) {
+    }
+
+    sparse(std::string const& tag, std::string const& label,
+           std::vector<int64_t> const& shape)
+            : sparse(tag, label, nullptr, shape) {
+    }
+
+    /* reads only the cells present in the file */
+    sparse(TFile* f, std::string const& tag)
+            : _tag(tag),
+              _count(0) {
+        _shape = shape_of(((TNamed*)f->Get(tag.data()))->GetTitle());
+        _dims = _shape.size();
+        _size = std::accumulate(std::begin(_shape), std::end(_shape), 1,
+                                std::multiplies<int64_t>());
+
+        TIter next(f->GetListOfKeys());
+        while (auto key = static_cast<TKey*>(next())) {
+            std::string name = key->GetName();
+            auto index = parse(name);
+            if (index < 0 || find(index)) { continue; }
+
+            auto obj = detach((H*)f->Get(name.data()));
+            obj->SetName(name.data());
+            slot(index) = obj;
+        }
+    }
+
+    sparse(sparse const& other, std::string const& prefix)
+            : _tag(prefix + "_" + other._tag),
+              _label(other._label),
+              _dims(other._dims),
+              _size(other._size),
+              _shape(other._shape),
+              _factory(other._factory),
+              _count(0) {
+        other.apply([&](H* obj, int64_t index) {
+            slot(index) = detach((H*)obj->Clone()); });
+
+        rename();
+    }
+
+    sparse(sparse const&) = delete;
+    sparse& operator=(sparse const&) = delete;
+    sparse(sparse&&) = default;
+
+    sparse& operator=(sparse&& other) {
+        if (this == &other) { return *this; }
+
+        clear();
+        _tag = std::move(other._tag);
+        _label = std::move(other._label);
+        _dims = other._dims;
+        _size = other._size;
+        _shape = std::move(other._shape);
+        _factory = std::move(other._factory);
+        _keys = std::move(other._keys);
+        _values = std::move(other._values);
+        _bits = other._bits;
+        _count = other._count;
+        other._keys.clear();
+        other._values.clear();
+        other._count = 0;
+
+        return *this;
+    }
+
+    ~sparse() { clear(); }
+
+    template <template <typename...> class T, typename U>
+    typename std::enable_if<std::is_integral<U>::value, int64_t>::type
+    index_for(T<U> const& indices) const {
+        return flatten(_shape, indices); }
+
+    std::vector<int64_t> indices_for(int64_t index) const {
+        std::vector<int64_t> indices(_dims);
+        indices_for(index, indices);
+
+        return indices;
+    }
+
+    template <typename T>
+    void indices_for(int64_t index, T& indices) const {
+        unravel(_shape, index, indices); }
+
+    /* null if the cell is not occupied */
+    H* find(int64_t index) const {
+        if (_keys.empty()) { return nullptr; }
+
+        auto i = probe(index);
+        return _keys[i] == index ? _values[i] : nullptr;
+    }
+
+    /* references from non-const access are invalidated by later insertions.
+     * without a factory, a null entry is left for the caller to assign */
+    H*& operator[](int64_t index) { return touch(index); }
+    H* operator[](int64_t index) const { return find(index); }
+
+    template <template <typename...> class T, typename U>
+    H*& operator[](T<U> const& indices) {
+        return touch(index_for(indices)); }
+
+    template <template <typename...> class T, typename U>
+    H* operator[](T<U> const& indices) const {
+        return find(index_for(indices)); }
+
+    void add(sparse const& other, double c1) {
+        other.apply([&](H* obj, int64_t index) {
+            touch(index, obj)->Add(obj, c1); });
+    }
+
+    void operator+=(sparse const& other) { add(other, 1); }
+    void operator-=(sparse const& other) { add(other, -1); }
+
+    void scale(double c1) {
+        apply([&](H* obj) { obj->Scale(c1); }); }
+
+    void operator*=(double c1) { scale(c1); }
+    void operator/=(double c1) { scale(1. / c1); }
+
+    /* inputs are added in ascending flat index, i.e. in order along axis */
+    sparse* sum(int64_t axis) const {
+        std::vector<int64_t> output = _shape;
+        output.erase(std::next(std::begin(output), axis));
+
+        if (output.empty()) { output.push_back(1); }
+
+        auto result = new sparse(_tag + "_sum" + std::to_string(axis),
+                                 _label, output);
+
+        std::vector<int64_t> indices(_dims);
+        for (auto index : occupied()) {
+            indices_for(index, indices);
+            indices.erase(std::next(std::begin(indices), axis));
+
+            auto obj = find(index);
+            result->touch(result->index_for(indices), obj)->Add(obj);
+            indices.resize(_dims);
+        }
+
+        return result;
+    }
+
+    template <typename... T>
+    sparse* sum(int64_t axis, T... axes) const {
+        auto partial = sum(axis);
+        auto result = partial->sum(axes...);
+        delete partial;
+
+        return result;
+    }
+
+    /* occupied flat indices, in ascending order */
+    std::vector<int64_t> occupied() const {
+        std::vector<int64_t> result;
+        result.reserve(_count);
+        for (std::size_t i = 0; i < _keys.size(); ++i)
+            if (_keys[i] != empty && _values[i])
+                result.push_back(_keys[i]);
+
+        std::sort(std::begin(result), std::end(result));
+        return result;
+    }
+
+    void apply(std::function<void(H*)> f) const {
+        for (std::size_t i = 0; i < _keys.size(); ++i)
+            if (_keys[i] != empty && _values[i])
+                f(_values[i]);
+    }
+
+    void apply(std::function<void(H*, int64_t)> f) const {
+        for (std::size_t i = 0; i < _keys.size(); ++i)
+            if (_keys[i] != empty && _values[i])
+                f(_values[i], _keys[i]);
+    }
+
+    void save(std::string const& prefix) const {
+        auto full = prefix.empty() ? "" : prefix + "_";
+        apply([&](H* obj) {
+            auto name = full + obj->GetName();
+            obj->Write(name.data(), TObject::kOverwrite); });
+
+        auto label = new TNamed((full + _tag).data(), stub(_shape).data());
+        label->Write("", TObject::kOverwrite);
+    }
+
+    void save() const { save(""); }
+
+    void rename(std::string const& tag) {
+        _tag = tag; rename(); }
+
+    void rename() {
+        std::string name;
+        apply([&](H* obj, int64_t index) {
+            format(name, _tag, _shape, index);
+            obj->SetName(name.data()); });
+    }
+
+    int64_t const& dims() const { return _dims; }
+    int64_t const& size() const { return _size; }
+    int64_t const& count() const { return _count; }
+    std::vector<int64_t> const& shape() const { return _shape; }
+
+  private:
+    static constexpr int64_t empty = -1;
+
+    std::size_t hash(int64_t index) const {
+        return (static_cast<uint64_t>(index) * 0x9e3779b97f4a7c15ull)
+            >> (64 - _bits); }
+
+    /* position of index in the table, or of the empty entry ending its
+     * probe sequence. the table must not be empty */
+    std::size_t probe(int64_t index) const {
+        auto i = hash(index);
+        while (_keys[i] != index && _keys[i] != empty)
+            i = (i + 1) & (_keys.size() - 1);
+
+        return i;
+    }
+
+    /* slot for index, inserting an empty entry if needed. the table grows
+     * only on insertion, so references to existing entries stay valid */
+    H*& slot(int64_t index) {
+        if (!_keys.empty()) {
+            auto i = probe(index);
+            if (_keys[i] == index) { return _values[i]; }
+        }
+
+        if (2 * (_count + 1) > static_cast<int64_t>(_keys.size()))
+            grow();
+
+        auto i = probe(index);
+        _keys[i] = index;
+        _values[i] = nullptr;
+        ++_count;
+
+        return _values[i];
+    }
+
+    void grow() {
+        auto keys = std::move(_keys);
+        auto values = std::move(_values);
+
+        _bits = keys.empty() ? 4 : _bits + 1;
+        _keys.assign(std::size_t(1) << _bits, empty);
+        _values.assign(std::size_t(1) << _bits, nullptr);
+        _count = 0;
+
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            if (keys[i] != empty)
+                slot(keys[i]) = values[i];
+    }
+
+    /* book a missing cell through the factory, or as an empty copy of like */
+    H*& touch(int64_t index, H const* like = nullptr) {
+        auto& obj = slot(index);
+        if (obj) { return obj; }
+
+        std::string name;
+        format(name, _tag, _shape, index);
+        if (_factory) {
+            obj = detach(_factory(index, name, _label));
+        } else if (like) {
+            obj = detach(static_cast<H*>(like->Clone(name.data())));
+            obj->Reset("MICES");
+        }
+
+        return obj;
+    }
+
+    /* flat index for a cell name of this history, -1 if not one */
+    int64_t parse(std::string const& name) const {
+        auto head = _tag + "_";
+        if (name.compare(0, head.size(), head)) { return -1; }
+
+        std::vector<int64_t> indices;
+        for (auto pos = head.size() - 1; pos != std::string::npos; ) {
+            auto next = name.find('_', pos + 1);
+            auto token = name.substr(pos + 1, next - pos - 1);
+            auto digit = [](char c) { return std::isdigit((unsigned char)c); };
+            if (token.empty() || !std::all_of(std::begin(token),
+                                              std::end(token), digit))
+                return -1;
+
+            indices.push_back(std::atoll(token.data()));
+            pos = next;
+        }
+
+        if (static_cast<int64_t>(indices.size()) != _dims) { return -1; }
+        for (int64_t i = 0; i < _dims; ++i)
+            if (indices[i] >= _shape[i]) { return -1; }
+
+        return index_for(indices);
+    }
+
+    void clear() {
+        apply([](H* obj) { dispose(obj); });
+
+        _keys.clear();
+        _values.clear();
+        _count = 0;
+    }
+
+    std::string _tag;
+    std::string _label;
+
+    int64_t _dims;
+    int64_t _size;
+    std::vector<int64_t> _shape;
+
+    std::function<H*(int64_t, std::string const&, std::string const&)> _factory;
+
+    int64_t _count;
+    int64_t _bits = 0;
+    std::vector<int64_t> _keys;
+    std::vector<H*> _values;
+};
+
+template <typename H>
+constexpr int64_t sparse<H>::empty;
+
+#endif /* SPARSE_H */
@@ -0,0 +1,342 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "execution.h"
+#include "history.h"
+
+#include "TNamed.h"
+#include "TObject.h"
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* non-owning view of the cells of a history, which must outlive it. each
+ * axis of the source is described by an offset, an extent and a stride,
+ * so that slices, fixed axes and rebinned ranges select cells in place.
+ * a cell of a rebinned view stands for a group of source cells, and is
+ * their sum. sum, apply and save read the source cells directly; cells are
+ * copied only by materialise (and the sums it and save compute) */
+template <typename H>
+class history_view {
+  public:
+    explicit history_view(history<H> const& source)
+            : history_view(source, source.tag()) {
+    }
+
+    history_view(history<H> const& source, std::string const& tag)
+            : _source(&source),
+              _tag(tag),
+              _base(0) {
+        int64_t block = 1;
+        for (auto const& extent : source.shape()) {
+            _spans.push_back({ extent, block, 1, block, true });
+            block = block * extent;
+        }
+
+        update();
+    }
+
+    /* indices [first, last) along axis, every stride-th */
+    history_view slice(int64_t axis, int64_t first, int64_t last,
+                       int64_t stride = 1) const {
+        auto result = *this;
+        auto& span = result.kept(axis);
+        if (first < 0 || last > span.extent || first >= last || stride < 1) {
+            throw std::out_of_range(
+                "history_view: slice [" + std::to_string(first) + ", "
+                + std::to_string(last) + ") of axis " + std::to_string(axis)
+                + " of " + _tag);
+        }
+
+        result._base = result._base + first * span.step;
+        span.extent = (last - first + stride - 1) / stride;
+        span.step = span.step * stride;
+        result.update();
+
+        return result;
+    }
+
+    /* axis fixed to one index, and dropped from the shape */
+    history_view fix(int64_t axis, int64_t index) const {
+        auto result = slice(axis, index, index + 1);
+        result.kept(axis).kept = false;
+        result.update();
+
+        return result;
+    }
+
+    /* groups of size consecutive indices along axis; trailing indices that
+     * do not fill a group are dropped */
+    history_view rebin(int64_t axis, int64_t size) const {
+        auto result = *this;
+        auto& span = result.kept(axis);
+        if (size < 1 || !span.merge()) {
+            throw std::invalid_argument(
+                "history_view: cannot rebin axis " + std::to_string(axis)
+                + " of " + _tag + " by " + std::to_string(size));
+        }
+
+        span.extent = span.extent / size;
+        span.group = span.group * size;
+        span.step = span.step * size;
+        result.update();
+
+        return result;
+    }
+
+    /* source cell of a view cell, which must not be rebinned */
+    H* operator[](int64_t index) const {
+        if (_volume != 1) {
+            throw std::logic_error("history_view: cells of " + _tag
+                                   + " are sums, use materialise");
+        }
+
+        return (*_source)[origin(index)];
+    }
+
+    /* flat index in the source of the first cell of a view cell */
+    int64_t origin(int64_t index) const {
+        int64_t result = _base;
+        for (auto const& span : _spans) {
+            if (!span.kept) { continue; }
+
+            result = result + (index % span.extent) * span.step;
+            index = index / span.extent;
+        }
+
+        return result;
+    }
+
+    /* f(obj, index) for each present source cell of each view cell */
+    void apply(std::function<void(H*)> f) const {
+        execution serial; apply(serial, f); }
+
+    void apply(std::function<void(H*, int64_t)> f) const {
+        execution serial; apply(serial, f); }
+
+    void apply(execution& exec, std::function<void(H*)> f) const {
+        exec.run(_size, [&](int64_t i) {
+            members(i, [&](H* obj) { f(obj); }); });
+    }
+
+    void apply(execution& exec, std::function<void(H*, int64_t)> f) const {
+        exec.run(_size, [&](int64_t i) {
+            members(i, [&](H* obj) { f(obj, i); }); });
+    }
+
+    /* as history::sum, reading the source cells in place */
+    history<H>* sum(int64_t axis) const {
+        execution serial; return sum(serial, axis); }
+
+    history<H>* sum(execution& exec, int64_t axis) const {
+        return reduce(exec, _tag + "_sum" + std::to_string(axis), { axis }); }
+
+    history<H>* sum(std::vector<int64_t> const& axes) const {
+        execution serial; return sum(serial, axes); }
+
+    history<H>* sum(execution& exec, std::vector<int64_t> const& axes) const {
+        std::string tag = _tag;
+        for (auto const& axis : axes)
+            tag = tag + "_sum" + std::to_string(axis);
+
+        return reduce(exec, tag, axes);
+    }
+
+    /* owning copy of the view */
+    history<H>* materialise(std::string const& tag) const {
+        execution serial; return materialise(serial, tag); }
+
+    history<H>* materialise(execution& exec, std::string const& tag) const {
+        return reduce(exec, tag, { }); }
+
+    /* history layout (objects), readable as a history of the view shape.
+     * names of source cells are overwritten while they are written */
+    void save(std::string const& prefix) const {
+        instrument::timer timer(phase::save);
+
+        auto full = prefix.empty() ? "" : prefix + "_";
+
+        for (int64_t i = 0; i < _size; ++i) {
+            auto obj = cell(i);
+            if (!obj) { continue; }
+
+            auto name = this->name(i);
+            obj->SetName(name.data());
+            obj->Write((full + name).data(), TObject::kOverwrite);
+
+            if (_volume != 1) { dispose(obj); }
+        }
+
+        auto label = new TNamed((full + _tag).data(), stub(_shape).data());
+        label->Write("", TObject::kOverwrite);
+    }
+
+    void save() const { save(""); }
+
+    std::string name(int64_t index) const {
+        std::string result;
+        format(result, _tag, _shape, index);
+
+        return result;
+    }
+
+    void rename(std::string const& tag) { _tag = tag; }
+
+    history<H> const& source() const { return *_source; }
+    std::string const& tag() const { return _tag; }
+    int64_t const& dims() const { return _dims; }
+    int64_t const& size() const { return _size; }
+    std::vector<int64_t> const& shape() const { return _shape; }
+
+    /* source cells per view cell */
+    int64_t const& volume() const { return _volume; }
+
+  private:
+    /* one axis of the source. index i along it covers the source cells at
+     * flat offsets i * step + k * pitch, for k < group */
+    struct span {
+        int64_t extent;
+        int64_t step;
+        int64_t group;
+        int64_t pitch;
+        bool kept;
+
+        /* whether consecutive groups can be merged, i.e. the cells they
+         * cover are evenly spaced */
+        bool merge() {
+            if (group == 1) { pitch = step; }
+            return group * pitch == step;
+        }
+    };
+
+    /* position in _spans of a view axis */
+    std::size_t position(int64_t axis) const {
+        for (std::size_t k = 0; k < _spans.size(); ++k)
+            if (_spans[k].kept && !axis--) { return k; }
+
+        throw std::out_of_range("history_view: no such axis in " + _tag);
+    }
+
+    span& kept(int64_t axis) { return _spans[position(axis)]; }
+
+    void update() {
+        _shape.clear();
+        _volume = 1;
+        for (auto const& span : _spans) {
+            if (span.kept) { _shape.push_back(span.extent); }
+            _volume = _volume * span.group;
+        }
+
+        _dims = _shape.size();
+        if (_shape.empty()) { _shape.push_back(1); }
+
+        _size = 1;
+        for (auto const& extent : _shape) { _size = _size * extent; }
+    }
+
+    /* f(obj) for each present source cell of view cell index */
+    template <typename F>
+    void members(int64_t index, F f) const {
+        auto base = origin(index);
+        if (_volume == 1) {
+            if (auto obj = (*_source)[base]) { f(obj); }
+            return;
+        }
+
+        std::vector<int64_t> counter(_spans.size(), 0);
+        for (int64_t j = 0, offset = 0; j < _volume; ++j) {
+            if (auto obj = (*_source)[base + offset]) { f(obj); }
+
+            for (std::size_t k = 0; k < _spans.size(); ++k) {
+                auto const& span = _spans[k];
+                offset = offset + span.pitch;
+                if (++counter[k] < span.group) { break; }
+
+                offset = offset - span.group * span.pitch;
+                counter[k] = 0;
+            }
+        }
+    }
+
+    /* new cell holding the sum of the members of view cell index (a clone,
+     * for views that are not rebinned), null if all of them are missing */
+    H* cell(int64_t index) const {
+        if (_volume == 1) { return (*_source)[origin(index)]; }
+
+        H* sum = nullptr;
+        members(index, [&](H* obj) {
+            if (!sum) {
+                sum = detach(static_cast<H*>(obj->Clone()));
+                sum->Reset("MICES");
+            }
+
+            sum->Add(obj);
+        });
+
+        return sum;
+    }
+
+    /* sum over axes (view numbering) in one pass over the source cells,
+     * computing the output cells in parallel */
+    history<H>* reduce(execution& exec, std::string const& tag,
+                       std::vector<int64_t> const& axes) const {
+        std::vector<std::size_t> positions;
+        for (auto const& axis : axes)
+            positions.push_back(position(axis));
+
+        auto reduced = *this;
+        for (auto const& k : positions) {
+            auto& span = reduced._spans[k];
+            if (!span.merge()) {
+                throw std::invalid_argument(
+                    "history_view: cannot sum over a strided, rebinned axis"
+                    " of " + _tag);
+            }
+
+            span.group = span.group * span.extent;
+            span.extent = 1;
+            span.kept = false;
+        }
+
+        reduced.update();
+
+        auto result = new history<H>(tag, _source->label(), reduced._shape);
+
+        exec.run(result->size(), [&](int64_t i) {
+            if (reduced._volume == 1) {
+                auto obj = (*_source)[reduced.origin(i)];
+                (*result)[i] = obj ? detach((H*)obj->Clone()) : nullptr;
+                return;
+            }
+
+            H* sum = nullptr;
+            reduced.members(i, [&](H* obj) {
+                if (!sum) {
+                    sum = detach(static_cast<H*>(obj->Clone()));
+                    sum->Reset("MICES");
+                }
+
+                sum->Add(obj);
+            });
+
+            (*result)[i] = sum;
+        });
+
+        return result;
+    }
+
+    history<H> const* _source;
+    std::string _tag;
+
+    int64_t _base;
+    std::vector<span> _spans;
+
+    int64_t _dims;
+    int64_t _size;
+    int64_t _volume;
+    std::vector<int64_t> _shape;
+};
+
+#endif /* VIEW_H */